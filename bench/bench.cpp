@@ -0,0 +1,448 @@
+// cannon-bench: end-to-end benchmarks of the compiler on generated programs.
+//
+// Each axis (functions per file, expression depth, call fan-out, file count) is swept on its own,
+// with the others held at their base values, and every program is taken through lex, parse_file,
+// analyze and codegen in-process. Time and allocations are reported per phase as JSON.
+//
+//   cannon-bench [--axis=functions|depth|fanout|files]... [--sizes=N,N,...] [--repeat=N] [-O<n>]
+//                [--output=results.json] [--compare=baseline.json] [--tolerance=1.15] [--max-slope=1.3]
+//
+// Any phase whose cost grows faster than linearly along an axis (a log-log slope above
+// --max-slope) is flagged, as is any phase that got slower or allocates more than --tolerance
+// times the --compare baseline. The exit status is 1 if anything was flagged.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <Config.hpp>
+
+#include "codegen.hpp"
+#include "diagnostics.hpp"
+#include "error.hpp"
+#include "lex.hpp"
+#include "parser.hpp"
+#include "semantic.hpp"
+#include "stats.hpp"
+#include "target.hpp"
+
+using namespace cannon;
+using namespace std::string_view_literals;
+
+namespace {
+
+struct workload {
+    unsigned functions{200}; // per file
+    unsigned depth{4};       // nesting of each function's arithmetic expression
+    unsigned fanout{2};      // calls to other functions in each function
+    unsigned files{1};
+};
+
+const std::vector<std::string_view> axes{"functions"sv, "depth"sv, "fanout"sv, "files"sv};
+const std::vector<std::string_view> phases{"lex"sv, "parse"sv, "analyze"sv, "codegen"sv};
+
+const std::map<std::string_view, std::vector<unsigned>> default_sizes{
+    {"functions"sv, {100, 200, 400, 800, 1600}},
+    {"depth"sv, {4, 8, 16, 32, 64}},
+    {"fanout"sv, {1, 2, 4, 8, 16}},
+    {"files"sv, {1, 2, 4, 8, 16}},
+};
+
+workload scaled(std::string_view axis, unsigned size) {
+    workload result;
+    if (axis == "functions"sv)
+        result.functions = size;
+    else if (axis == "depth"sv)
+        result.depth = size;
+    else if (axis == "fanout"sv)
+        result.fanout = size;
+    else
+        result.files = size;
+    return result;
+}
+
+// Function i of a file calls the `fanout` functions defined just before it
+std::string generate_file(const workload &w, unsigned file) {
+    static constexpr std::string_view ops[] = {"+"sv, "-"sv, "*"sv, "/"sv};
+    std::string result;
+    for (unsigned i = 0; i < w.functions; i++) {
+        std::string expr = "1";
+        for (unsigned d = 1; d <= w.depth; d++)
+            expr = "(" + expr + " " + std::string{ops[d % 4]} + " " + std::to_string(1 + d % 9) + ")";
+        for (unsigned k = 1; k <= w.fanout && k <= i; k++)
+            expr += " + f" + std::to_string(file) + "_" + std::to_string(i - k) + "()";
+        result += "fn f" + std::to_string(file) + "_" + std::to_string(i) + "() -> i32 {\n    " + expr + "\n}\n\n";
+    }
+    return result;
+}
+
+struct phase_sample {
+    double seconds{0};
+    std::uint64_t allocations{0};
+    std::uint64_t bytes{0};
+};
+
+struct result {
+    std::string axis;
+    unsigned size;
+    workload load;
+    std::uint64_t source_bytes{0};
+    std::map<std::string_view, phase_sample> phases;
+};
+
+template <typename F>
+auto measure(phase_sample &sample, F &&f) {
+    auto allocations = thread_allocations();
+    auto start = std::chrono::steady_clock::now();
+    auto value = f();
+    sample.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto end = thread_allocations();
+    sample.allocations += end.allocations - allocations.allocations;
+    sample.bytes += end.bytes - allocations.bytes;
+    return value;
+}
+
+// One compilation of every file of the workload, phase by phase
+std::map<std::string_view, phase_sample> compile_once(const std::vector<std::string> &sources,
+        llvm::TargetMachine &target_machine, const codegen_options &options) {
+    std::map<std::string_view, phase_sample> samples;
+    source_manager files;
+    for (const auto &source : sources) {
+        auto tokens = measure(samples["lex"sv], [&] { return lex(files.add("bench.cannon", source)); });
+        auto parsed = measure(samples["parse"sv], [&] { return parse_file(std::move(tokens)); });
+        auto analysed = measure(samples["analyze"sv], [&] { return analyze(std::move(parsed)); });
+        measure(samples["codegen"sv], [&] {
+            llvm::SmallVector<char, 0> object;
+            llvm::raw_svector_ostream stream{object};
+            codegen(analysed, stream, target_machine, options);
+            return object.size();
+        });
+    }
+    return samples;
+}
+
+result run(std::string_view axis, unsigned size, unsigned repeat, llvm::TargetMachine &target_machine, const codegen_options &options) {
+    result r{std::string{axis}, size, scaled(axis, size)};
+    std::vector<std::string> sources;
+    for (unsigned file = 0; file < r.load.files; file++) {
+        sources.push_back(generate_file(r.load, file));
+        r.source_bytes += sources.back().size();
+    }
+    // The fastest run is the least disturbed; allocations are the same every time
+    for (unsigned i = 0; i < repeat; i++) {
+        auto samples = compile_once(sources, target_machine, options);
+        for (auto &[phase, sample] : samples) {
+            if (i == 0 || sample.seconds < r.phases[phase].seconds)
+                r.phases[phase] = sample;
+        }
+    }
+    return r;
+}
+
+struct finding {
+    std::string kind; // "superlinear" or "regression"
+    std::string axis;
+    unsigned size{0};
+    std::string phase;
+    std::string metric; // "seconds" or "bytes"
+    double value;       // the slope, or the ratio to the baseline
+};
+
+double metric_of(const phase_sample &sample, std::string_view metric) {
+    return metric == "seconds"sv ? sample.seconds : static_cast<double>(sample.bytes);
+}
+
+// Times under this are mostly noise
+constexpr double min_seconds = 1e-4;
+
+// Least-squares slope of log(cost) against log(size): 1 is linear, 2 quadratic
+std::vector<finding> find_superlinear(const std::vector<result> &results, double max_slope) {
+    std::vector<finding> findings;
+    for (auto axis : axes) {
+        for (auto phase : phases) {
+            for (auto metric : {"seconds"sv, "bytes"sv}) {
+                std::vector<std::pair<double, double>> points;
+                for (const auto &r : results) {
+                    if (r.axis != axis)
+                        continue;
+                    double value = metric_of(r.phases.at(phase), metric);
+                    if (value > (metric == "seconds"sv ? min_seconds : 0))
+                        points.emplace_back(std::log(static_cast<double>(r.size)), std::log(value));
+                }
+                if (points.size() < 3)
+                    continue;
+                double mean_x = 0, mean_y = 0;
+                for (auto [x, y] : points) {
+                    mean_x += x / points.size();
+                    mean_y += y / points.size();
+                }
+                double covariance = 0, variance = 0;
+                for (auto [x, y] : points) {
+                    covariance += (x - mean_x) * (y - mean_y);
+                    variance += (x - mean_x) * (x - mean_x);
+                }
+                if (variance == 0)
+                    continue;
+                double slope = covariance / variance;
+                if (slope > max_slope)
+                    findings.push_back({"superlinear", std::string{axis}, 0, std::string{phase}, std::string{metric}, slope});
+            }
+        }
+    }
+    return findings;
+}
+
+// llvm::json returns llvm::Optional or std::optional depending on the LLVM version
+template <typename Optional, typename T>
+T value_or(const Optional &value, T fallback) {
+    return value ? static_cast<T>(*value) : fallback;
+}
+
+std::optional<std::vector<result>> load_results(const std::string &path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+        std::cerr << "Cannot read " << path << ": " << buffer.getError().message() << std::endl;
+        return std::nullopt;
+    }
+    auto json = llvm::json::parse((*buffer)->getBuffer());
+    if (!json) {
+        llvm::logAllUnhandledErrors(json.takeError(), llvm::errs(), path + ": ");
+        return std::nullopt;
+    }
+    std::vector<result> results;
+    auto root = json->getAsObject();
+    auto list = root ? root->getArray("results") : nullptr;
+    if (!list) {
+        std::cerr << path << " is not a cannon-bench result file" << std::endl;
+        return std::nullopt;
+    }
+    for (const auto &entry : *list) {
+        auto object = entry.getAsObject();
+        if (!object)
+            continue;
+        result r{value_or(object->getString("axis"), llvm::StringRef{}).str(),
+            value_or(object->getInteger("size"), 0u)};
+        if (auto recorded = object->getObject("phases")) {
+            for (auto phase : phases) {
+                auto sample = recorded->getObject(llvm::StringRef{phase.data(), phase.size()});
+                if (!sample)
+                    continue;
+                r.phases[phase] = {value_or(sample->getNumber("seconds"), 0.0),
+                    value_or(sample->getInteger("allocations"), std::uint64_t{0}),
+                    value_or(sample->getInteger("bytes"), std::uint64_t{0})};
+            }
+        }
+        results.push_back(std::move(r));
+    }
+    return results;
+}
+
+std::vector<finding> find_regressions(const std::vector<result> &results, const std::vector<result> &baseline, double tolerance) {
+    std::vector<finding> findings;
+    for (const auto &r : results) {
+        auto old = std::find_if(baseline.begin(), baseline.end(), [&](const result &b) { return b.axis == r.axis && b.size == r.size; });
+        if (old == baseline.end())
+            continue;
+        for (auto phase : phases) {
+            auto before = old->phases.find(phase);
+            if (before == old->phases.end())
+                continue;
+            for (auto metric : {"seconds"sv, "bytes"sv}) {
+                double was = metric_of(before->second, metric);
+                double now = metric_of(r.phases.at(phase), metric);
+                if (metric == "seconds"sv && was < min_seconds)
+                    continue;
+                if (was > 0 && now / was > tolerance)
+                    findings.push_back({"regression", r.axis, r.size, std::string{phase}, std::string{metric}, now / was});
+            }
+        }
+    }
+    return findings;
+}
+
+void write_results(llvm::raw_ostream &out, const std::vector<result> &results, const std::vector<finding> &findings) {
+    llvm::json::OStream json{out, 2};
+    json.object([&] {
+        json.attributeArray("results", [&] {
+            for (const auto &r : results) {
+                json.object([&] {
+                    json.attribute("axis", r.axis);
+                    json.attribute("size", r.size);
+                    json.attribute("functions", r.load.functions);
+                    json.attribute("depth", r.load.depth);
+                    json.attribute("fanout", r.load.fanout);
+                    json.attribute("files", r.load.files);
+                    json.attribute("source-bytes", static_cast<int64_t>(r.source_bytes));
+                    json.attributeObject("phases", [&] {
+                        for (auto &[phase, sample] : r.phases) {
+                            json.attributeObject(llvm::StringRef{phase.data(), phase.size()}, [&] {
+                                json.attribute("seconds", sample.seconds);
+                                json.attribute("allocations", static_cast<int64_t>(sample.allocations));
+                                json.attribute("bytes", static_cast<int64_t>(sample.bytes));
+                            });
+                        }
+                    });
+                });
+            }
+        });
+        json.attributeArray("findings", [&] {
+            for (const auto &f : findings) {
+                json.object([&] {
+                    json.attribute("kind", f.kind);
+                    json.attribute("axis", f.axis);
+                    if (f.size)
+                        json.attribute("size", f.size);
+                    json.attribute("phase", f.phase);
+                    json.attribute("metric", f.metric);
+                    json.attribute(f.kind == "superlinear" ? "slope" : "ratio", f.value);
+                });
+            }
+        });
+    });
+    out << "\n";
+}
+
+// All of `text` as a number; nothing if it isn't one, or has anything after it
+template <typename T>
+std::optional<T> parse_number(std::string_view text) {
+    T value{};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc{} || end != text.data() + text.size())
+        return std::nullopt;
+    return value;
+}
+
+int bench(const std::vector<std::string_view> &args) {
+    std::vector<std::string_view> selected_axes;
+    std::optional<std::vector<unsigned>> sizes;
+    unsigned repeat{3};
+    codegen_options options{};
+    std::optional<std::string> output;
+    std::optional<std::string> compare;
+    double tolerance{1.15};
+    double max_slope{1.3};
+    for (auto arg : args) {
+        if (arg.starts_with("--axis="sv)) {
+            auto axis = arg.substr(7);
+            if (std::find(axes.begin(), axes.end(), axis) == axes.end()) {
+                std::cerr << "Unknown axis " << axis << std::endl;
+                return 2;
+            }
+            selected_axes.push_back(axis);
+        } else if (arg.starts_with("--sizes="sv)) {
+            sizes.emplace();
+            std::istringstream list{std::string{arg.substr(8)}};
+            for (std::string size; std::getline(list, size, ',');) {
+                auto value = parse_number<unsigned>(size);
+                if (!value) {
+                    std::cerr << "--sizes takes whole numbers, not \"" << size << "\"" << std::endl;
+                    return 2;
+                }
+                sizes->push_back(*value);
+            }
+            if (sizes->empty()) {
+                std::cerr << "--sizes needs at least one size" << std::endl;
+                return 2;
+            }
+        } else if (arg.starts_with("--repeat="sv)) {
+            auto value = parse_number<unsigned>(arg.substr(9));
+            if (!value) {
+                std::cerr << "--repeat takes a whole number, not \"" << arg.substr(9) << "\"" << std::endl;
+                return 2;
+            }
+            repeat = std::max(1u, *value);
+        } else if (arg.starts_with("-O"sv) && arg.size() == 3 && arg[2] >= '0' && arg[2] <= '3') {
+            options.opt_level = optimization_level{static_cast<unsigned char>(arg[2] - '0')};
+        } else if (arg.starts_with("--output="sv)) {
+            output = std::string{arg.substr(9)};
+        } else if (arg.starts_with("--compare="sv)) {
+            compare = std::string{arg.substr(10)};
+        } else if (arg.starts_with("--tolerance="sv)) {
+            auto value = parse_number<double>(arg.substr(12));
+            if (!value) {
+                std::cerr << "--tolerance takes a number, not \"" << arg.substr(12) << "\"" << std::endl;
+                return 2;
+            }
+            tolerance = *value;
+        } else if (arg.starts_with("--max-slope="sv)) {
+            auto value = parse_number<double>(arg.substr(12));
+            if (!value) {
+                std::cerr << "--max-slope takes a number, not \"" << arg.substr(12) << "\"" << std::endl;
+                return 2;
+            }
+            max_slope = *value;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 2;
+        }
+    }
+    if (selected_axes.empty())
+        selected_axes = axes;
+
+    // Nothing the compiler prints belongs in the report
+    std::ostream discard{nullptr};
+    diagnostic_redirect quiet{discard, discard};
+    target_machine_lease target_machine{target_spec{CANNON_DEFAULT_TRIPLE}};
+
+    std::vector<result> results;
+    for (auto axis : selected_axes) {
+        for (auto size : sizes ? *sizes : default_sizes.at(axis)) {
+            std::cerr << axis << " = " << size << std::endl;
+            results.push_back(run(axis, size, repeat, *target_machine, options));
+        }
+    }
+
+    auto findings = find_superlinear(results, max_slope);
+    if (compare) {
+        auto baseline = load_results(*compare);
+        if (!baseline)
+            return 2;
+        auto regressions = find_regressions(results, *baseline, tolerance);
+        findings.insert(findings.end(), regressions.begin(), regressions.end());
+    }
+    for (const auto &f : findings) {
+        std::cerr << f.kind << ": " << f.phase << " " << f.metric << " along " << f.axis;
+        if (f.kind == "superlinear")
+            std::cerr << " grows with slope " << f.value << std::endl;
+        else
+            std::cerr << " = " << f.size << " is " << f.value << "x the baseline" << std::endl;
+    }
+
+    if (output) {
+        std::error_code error;
+        llvm::raw_fd_ostream out{*output, error};
+        if (error) {
+            std::cerr << "Cannot write " << *output << ": " << error.message() << std::endl;
+            return 2;
+        }
+        write_results(out, results, findings);
+    } else {
+        write_results(llvm::outs(), results, findings);
+    }
+    return findings.empty() ? 0 : 1;
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string_view> args(argv + 1, argv + argc);
+    try {
+        return bench(args);
+    } catch (const compiler_exit &exit) {
+        return exit.status;
+    }
+}
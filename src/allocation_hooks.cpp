@@ -0,0 +1,40 @@
+#include <cstdlib>
+#include <new>
+
+#include "stats.hpp"
+
+// Counting replacements for the global allocation functions. They live in the executables rather than
+// the library, so embedders keep their own allocator. They stay on all the time: a thread-local
+// increment is cheap next to malloc, and the counts are only read for -fstats.
+// The array and nothrow forms forward to these, as the standard library's defaults do.
+void *operator new(std::size_t size) {
+    cannon::count_allocation(size);
+    if (void *result = std::malloc(size ? size : 1))
+        return result;
+    throw std::bad_alloc{};
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    cannon::count_allocation(size);
+    auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment
+    if (void *result = std::aligned_alloc(align, (size + align - 1) / align * align + (size ? 0 : align)))
+        return result;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
@@ -7,21 +7,29 @@ using namespace cannon;
 using namespace std::string_view_literals;
 
 ast_node::~ast_node() {}
-[[nodiscard]] uint64_t ast_node::get_line() const noexcept { return line; }
-[[nodiscard]] uint32_t ast_node::get_column() const noexcept { return column; }
+[[nodiscard]] source_location ast_node::get_location() const noexcept { return location; }
+void ast_node::set_location(source_location location) noexcept { this->location = location; }
 
 std::ostream &ast_node::pretty_print(std::ostream &os, std::string indent) const noexcept {
     os << get_node_name();
     return os;
 }
 
-identifier_node::identifier_node(std::string value) noexcept : value(std::move(value)) {}
+identifier_node::identifier_node(std::string_view value) : value(interned_names().intern(value)) {}
+identifier_node::identifier_node(name_id value) noexcept : value(value) {}
 [[nodiscard]] std::string_view identifier_node::get_node_name() const noexcept {
     return "Identifier"sv;
 }
-[[nodiscard]] const std::string &identifier_node::get_value() const noexcept {
+[[nodiscard]] name_id identifier_node::get_id() const noexcept {
     return value;
 }
+[[nodiscard]] std::string_view identifier_node::get_value() const noexcept {
+    return interned_names().text(value);
+}
+std::ostream &identifier_node::pretty_print(std::ostream &os, std::string indent) const noexcept {
+    os << get_node_name() << " (" << get_value() << ")";
+    return os;
+}
 
 type_node::type_node(std::unique_ptr<identifier_node> name) noexcept : name(std::move(name)) {}
 [[nodiscard]] std::string_view type_node::get_node_name() const noexcept {
@@ -212,7 +220,7 @@ binary_expression_node::binary_expression_node(
     return "Binary expression"sv;
 }
 
-std::map<binary_operator, std::string_view> ops_strings = {
+const std::map<binary_operator, std::string_view> ops_strings = {
     {ADD, "+"sv},
     {SUB, "-"sv},
     {MUL, "*"sv},
@@ -224,7 +232,7 @@ std::ostream &binary_expression_node::pretty_print(std::ostream &os, std::string
     os << indent << "LHS: ";
     get_lhs().pretty_print(os, indent + "  ");
     os << std::endl;
-    os << indent << "Operator: \"" << ops_strings[get_op()] << "\"" << std::endl;
+    os << indent << "Operator: \"" << ops_strings.at(get_op()) << "\"" << std::endl;
     os << indent << "RHS: ";
     get_rhs().pretty_print(os, indent + "  ");
     return os;
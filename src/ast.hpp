@@ -1,7 +1,6 @@
 #ifndef CANNON_AST_HPP
 #define CANNON_AST_HPP
 
-#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <optional>
@@ -9,16 +8,18 @@
 #include <string_view>
 #include <vector>
 
+#include "interner.hpp"
+#include "source.hpp"
+
 namespace cannon {
 
 class ast_node {
   private:
-    uint64_t line;
-    uint32_t column;
+    source_location location{0};
 
   public:
-    [[nodiscard]] uint64_t get_line() const noexcept;
-    [[nodiscard]] uint32_t get_column() const noexcept;
+    [[nodiscard]] source_location get_location() const noexcept;
+    void set_location(source_location location) noexcept;
     [[nodiscard]] virtual std::string_view get_node_name() const noexcept = 0;
     virtual std::ostream &pretty_print(std::ostream &os, std::string indent) const noexcept;
     friend std::ostream &operator<<(std::ostream &os, const ast_node &node) {
@@ -27,7 +28,7 @@ class ast_node {
     virtual ~ast_node() = 0;
 };
 
-template <typename T> class value_node : public ast_node {
+template <typename T> class value_node : public virtual ast_node {
   public:
     [[nodiscard]] virtual const T &get_value() const noexcept = 0;
     virtual ~value_node() = 0;
@@ -46,14 +47,18 @@ class pattern_node : public ast_node { // Base interface
     virtual ~pattern_node() = 0;
 };
 
-class identifier_node : public value_node<std::string> {
+// The name is interned, so copies of it are an ID
+class identifier_node : public virtual ast_node {
   private:
-    std::string value;
+    name_id value;
 
   public:
-    identifier_node(std::string value) noexcept;
+    identifier_node(std::string_view value);
+    explicit identifier_node(name_id value) noexcept;
     [[nodiscard]] std::string_view get_node_name() const noexcept override;
-    [[nodiscard]] const std::string &get_value() const noexcept override;
+    [[nodiscard]] name_id get_id() const noexcept;
+    [[nodiscard]] std::string_view get_value() const noexcept;
+    std::ostream &pretty_print(std::ostream &os, std::string indent) const noexcept override;
 };
 
 class identifier_pattern_node : public pattern_node {
@@ -61,7 +66,7 @@ class identifier_pattern_node : public pattern_node {
     identifier_node pattern;
 
   public:
-    identifier_pattern_node(std::string value) noexcept;
+    identifier_pattern_node(std::string_view value);
     [[nodiscard]] std::string_view get_node_name() const noexcept override;
 };
 
@@ -88,7 +93,7 @@ class parameter_node : public ast_node {
     [[nodiscard]] const type_node &get_type() const noexcept;
 };
 
-class statement_node : public ast_node { // Base interface
+class statement_node : public virtual ast_node { // Base interface
   public:
     virtual ~statement_node() = 0;
 };
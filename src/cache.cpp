@@ -0,0 +1,99 @@
+#include "cache.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <Config.hpp>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+namespace cannon {
+
+cache_key_builder::cache_key_builder() {
+    add("version", CANNON_VERSION);
+}
+
+cache_key_builder &cache_key_builder::add(std::string_view name, llvm::StringRef value) {
+    // Length-prefixed, so that no two different sets of fields can produce the same bytes
+    m_data += std::to_string(name.size()) + ":" + std::string{name} + std::to_string(value.size()) + ":";
+    m_data += value;
+    return *this;
+}
+
+std::string cache_key_builder::finish() const {
+    llvm::SHA1 hasher;
+    hasher.update(m_data);
+    return llvm::toHex(hasher.final());
+}
+
+compilation_cache::compilation_cache(std::string dir, std::string_view size_limit) : m_dir(std::move(dir)) {
+    auto policy = llvm::parseCachePruningPolicy("cache_size_bytes=" + std::string{size_limit});
+    if (!policy) {
+        report({diagnostic_level::Error, {}, 0, 0, "Invalid --cache-size: " + llvm::toString(policy.takeError())});
+        throw compiler_exit{1};
+    }
+    m_policy = *policy;
+    if (auto error = llvm::sys::fs::create_directories(m_dir)) {
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to create cache directory " + m_dir + ": " + error.message()});
+        throw compiler_exit{1};
+    }
+}
+
+// pruneCache only ever considers files with this prefix
+static std::string entry_path(const std::string &dir, const std::string &key) {
+    llvm::SmallString<128> path{dir};
+    llvm::sys::path::append(path, "llvmcache-" + key);
+    return std::string{path};
+}
+
+std::unique_ptr<llvm::MemoryBuffer> compilation_cache::lookup(const std::string &key) const {
+    auto path = entry_path(m_dir, key);
+    int fd;
+    if (llvm::sys::fs::openFileForRead(path, fd))
+        return nullptr;
+    // Eviction goes by access time, which noatime mounts never update, so bump it by hand
+    llvm::sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+    auto buffer = llvm::MemoryBuffer::getOpenFile(llvm::sys::fs::convertFDToNativeFile(fd), path, -1);
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    if (!buffer)
+        return nullptr;
+    return std::move(*buffer);
+}
+
+void compilation_cache::insert(const std::string &key, llvm::StringRef contents) const {
+    llvm::SmallString<128> temp_path{m_dir};
+    llvm::sys::path::append(temp_path, "tmp-%%%%%%%%%%%%");
+    int fd;
+    if (llvm::sys::fs::createUniqueFile(temp_path, fd, temp_path))
+        return; // A cache that can't be written to is just a cache that misses
+    {
+        llvm::raw_fd_ostream out(fd, true);
+        out << contents;
+        if (out.has_error()) {
+            out.clear_error();
+            llvm::sys::fs::remove(temp_path);
+            return;
+        }
+    }
+    // Whoever renames last wins, and both wrote the same bytes anyway
+    if (llvm::sys::fs::rename(temp_path, entry_path(m_dir, key)))
+        llvm::sys::fs::remove(temp_path);
+}
+
+void compilation_cache::prune() const {
+    llvm::pruneCache(m_dir, m_policy);
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef CANNON_CACHE_HPP
+#define CANNON_CACHE_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace cannon {
+
+// Builds up the key for one compilation out of everything that can change its output
+class cache_key_builder {
+  private:
+    std::string m_data;
+  public:
+    cache_key_builder();
+    cache_key_builder &add(std::string_view name, llvm::StringRef value);
+    std::string finish() const;
+};
+
+// A content-addressed store of compiled artifacts, shared between processes.
+// Entries are published with an atomic rename, so concurrent compilers never see a partial entry,
+// and the directory is kept under its size limit by evicting the least recently used entries.
+class compilation_cache {
+  private:
+    std::string m_dir;
+    llvm::CachePruningPolicy m_policy;
+  public:
+    // `size_limit` takes the same forms as LLVM's cache_size_bytes policy (e.g. 500m, 2g)
+    compilation_cache(std::string dir, std::string_view size_limit);
+    std::unique_ptr<llvm::MemoryBuffer> lookup(const std::string &key) const;
+    void insert(const std::string &key, llvm::StringRef contents) const;
+    void prune() const;
+};
+
+}
+
+#endif // CANNON_CACHE_HPP
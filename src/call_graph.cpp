@@ -0,0 +1,131 @@
+#include "call_graph.hpp"
+
+#include <algorithm>
+
+namespace cannon {
+
+call_graph::call_graph(std::size_t functions) : m_callees(functions) {}
+
+void call_graph::add_call(std::uint32_t caller, std::uint32_t callee) {
+    auto &callees = m_callees[caller];
+    // Functions call few others, so a scan beats keeping a set per function
+    if (std::find(callees.begin(), callees.end(), callee) == callees.end())
+        callees.push_back(callee);
+}
+
+const std::vector<std::uint32_t>& call_graph::callees(std::uint32_t caller) const {
+    return m_callees[caller];
+}
+
+std::size_t call_graph::size() const noexcept {
+    return m_callees.size();
+}
+
+std::vector<bool> call_graph::reachable_from(const std::vector<std::uint32_t> &roots) const {
+    std::vector<bool> reached(m_callees.size());
+    std::vector<std::uint32_t> pending;
+    for (auto root : roots) {
+        if (!reached[root]) {
+            reached[root] = true;
+            pending.push_back(root);
+        }
+    }
+    while (!pending.empty()) {
+        auto fn = pending.back();
+        pending.pop_back();
+        for (auto callee : m_callees[fn]) {
+            if (!reached[callee]) {
+                reached[callee] = true;
+                pending.push_back(callee);
+            }
+        }
+    }
+    return reached;
+}
+
+// Tarjan's algorithm without recursion, since call chains in generated code can be deep. Calls
+// `component` with each strongly connected component, callees' components first.
+template <typename F>
+static void for_each_component(const std::vector<std::vector<std::uint32_t>> &callees, F &&component) {
+    constexpr auto unvisited = static_cast<std::uint32_t>(-1);
+    std::vector<std::uint32_t> index(callees.size(), unvisited), low(callees.size());
+    std::vector<bool> on_stack(callees.size());
+    std::vector<std::uint32_t> stack;
+    // Function and how many of its callees have been looked at
+    std::vector<std::pair<std::uint32_t, std::size_t>> frames;
+    std::uint32_t next_index = 0;
+    for (std::uint32_t start = 0; start < callees.size(); start++) {
+        if (index[start] != unvisited)
+            continue;
+        frames.emplace_back(start, 0);
+        index[start] = low[start] = next_index++;
+        stack.push_back(start);
+        on_stack[start] = true;
+        while (!frames.empty()) {
+            auto &[fn, next] = frames.back();
+            if (next < callees[fn].size()) {
+                auto callee = callees[fn][next++];
+                if (index[callee] == unvisited) {
+                    index[callee] = low[callee] = next_index++;
+                    stack.push_back(callee);
+                    on_stack[callee] = true;
+                    frames.emplace_back(callee, 0);
+                } else if (on_stack[callee]) {
+                    low[fn] = std::min(low[fn], index[callee]);
+                }
+                continue;
+            }
+            auto done = fn;
+            frames.pop_back();
+            if (!frames.empty())
+                low[frames.back().first] = std::min(low[frames.back().first], low[done]);
+            if (low[done] != index[done])
+                continue;
+            std::vector<std::uint32_t> members;
+            std::uint32_t member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                on_stack[member] = false;
+                members.push_back(member);
+            } while (member != done);
+            component(members);
+        }
+    }
+}
+
+std::vector<bool> call_graph::recursive() const {
+    std::vector<bool> result(m_callees.size());
+    for_each_component(m_callees, [&](const std::vector<std::uint32_t> &members) {
+        auto fn = members.front();
+        bool calls_itself = std::find(m_callees[fn].begin(), m_callees[fn].end(), fn) != m_callees[fn].end();
+        if (members.size() > 1 || calls_itself)
+            for (auto member : members)
+                result[member] = true;
+    });
+    return result;
+}
+
+std::vector<std::uint32_t> call_graph::bottom_up_order() const {
+    std::vector<std::uint32_t> result;
+    for_each_component(m_callees, [&](const std::vector<std::uint32_t> &members) {
+        result.insert(result.end(), members.begin(), members.end());
+    });
+    return result;
+}
+
+call_graph call_graph::subgraph(const std::vector<bool> &keep) const {
+    std::vector<std::uint32_t> renumbered(m_callees.size());
+    std::uint32_t kept = 0;
+    for (std::size_t i = 0; i < m_callees.size(); i++)
+        if (keep[i])
+            renumbered[i] = kept++;
+    call_graph result{kept};
+    for (std::uint32_t i = 0; i < m_callees.size(); i++)
+        if (keep[i])
+            for (auto callee : m_callees[i])
+                result.add_call(renumbered[i], renumbered[callee]);
+    return result;
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef CANNON_CALL_GRAPH_HPP
+#define CANNON_CALL_GRAPH_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace cannon {
+
+// Which functions of a program call which, by index into program::functions(). Only calls that
+// resolved to a function of the same program are edges; imported and external callees aren't.
+class call_graph {
+  private:
+    std::vector<std::vector<std::uint32_t>> m_callees;
+  public:
+    explicit call_graph(std::size_t functions = 0);
+
+    void add_call(std::uint32_t caller, std::uint32_t callee);
+    // Each callee once, in the order of the first call to it
+    const std::vector<std::uint32_t>& callees(std::uint32_t caller) const;
+    std::size_t size() const noexcept;
+
+    // Whether each function is `roots` or is called, directly or not, from one of them
+    std::vector<bool> reachable_from(const std::vector<std::uint32_t> &roots) const;
+    // Whether each function can call itself, directly or through others
+    std::vector<bool> recursive() const;
+    // Every function after all of its callees, except where recursion makes that impossible
+    std::vector<std::uint32_t> bottom_up_order() const;
+    // The graph between the functions `keep` selects, renumbered in order. Kept functions must
+    // not call dropped ones.
+    call_graph subgraph(const std::vector<bool> &keep) const;
+};
+
+}
+
+#endif // CANNON_CALL_GRAPH_HPP
@@ -0,0 +1,153 @@
+#include "check.hpp"
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "deps.hpp"
+#include "diagnostics.hpp"
+#include "error.hpp"
+#include "lex.hpp"
+#include "module_interface.hpp"
+#include "parser.hpp"
+#include "pipeline.hpp"
+#include "semantic.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+// One input being checked, with the messages it produced, printed in input order once all are done
+struct check_unit {
+    std::string_view file;
+    std::string out;
+    std::string err;
+    int status{0};
+    std::exception_ptr exception{};
+};
+
+static void check_unit_file(check_unit &unit, source_manager &sources, const symbol_table &imports) {
+    diagnostic_buffer buffer;
+    try {
+        diagnostic_context context{unit.file, nullptr, &sources};
+        auto contents = llvm::MemoryBuffer::getFile(unit.file);
+        if (!contents) {
+            report({diagnostic_level::Error, std::string{unit.file}, 0, 0, "Cannot open: " + contents.getError().message()});
+            throw compiler_exit{1};
+        }
+        analyze(parse_file(lex(sources.add(std::string{unit.file}, std::move(*contents)))), imports);
+    } catch (const compiler_exit &exit) {
+        unit.status = exit.status;
+    } catch (...) {
+        unit.exception = std::current_exception();
+    }
+    unit.out = buffer.out();
+    unit.err = buffer.err();
+}
+
+static int check(const std::vector<std::string_view> &args) {
+    bool dependencies = false;
+    std::optional<std::string_view> depfile{};
+    std::optional<std::string_view> depfile_target{};
+    std::optional<std::string_view> dep_graph{};
+    std::string_view output{"a.out"};
+    std::vector<std::string_view> import_paths{};
+    std::vector<std::string_view> input_files{};
+    unsigned jobs{default_jobs()};
+
+    // Options that take the next argument as their value
+    auto value_of = [&](auto &it) {
+        if (++it == args.end()) {
+            report({diagnostic_level::Error, {}, 0, 0, std::string{*(it - 1)} + " needs a value"});
+            throw compiler_exit{1};
+        }
+        return *it;
+    };
+    for (auto it = args.begin() + 1; it != args.end(); it++) {
+        auto opt = *it;
+        if (opt == "--check"sv || opt == "-ftype-check"sv) {
+            dependencies = false;
+        } else if (opt == "--deps"sv || opt == "-M"sv) {
+            dependencies = true;
+        } else if (opt == "-MF"sv) {
+            depfile = value_of(it);
+        } else if (opt == "-MT"sv) {
+            depfile_target = value_of(it);
+        } else if (opt.starts_with("--dep-graph="sv)) {
+            dep_graph = opt.substr(12);
+        } else if (opt == "-o"sv) {
+            output = value_of(it);
+        } else if (opt == "--import"sv) {
+            import_paths.push_back(value_of(it));
+        } else if (opt.starts_with("--import="sv)) {
+            import_paths.push_back(opt.substr(9));
+        } else if (opt == "-j"sv) {
+            jobs = std::max(1u, parse_count("-j"sv, value_of(it)));
+        } else if (opt.starts_with("-j"sv)) {
+            jobs = std::max(1u, parse_count("-j"sv, opt.substr(2)));
+        } else if (opt.starts_with("-"sv) && opt.size() > 1) {
+            report({diagnostic_level::Error, {}, 0, 0, std::string{opt} + " is not an option of --check or --deps; use cannon-bootstrap"});
+            throw compiler_exit{1};
+        } else {
+            input_files.push_back(opt);
+        }
+    }
+
+    if (dependencies) {
+        // Lexer and item pre-parse only; the graph goes to stdout unless asked for elsewhere
+        auto deps = scan_dependencies(std::vector<std::string>(input_files.begin(), input_files.end()), jobs);
+        if (depfile) {
+            std::ofstream out{std::string{*depfile}};
+            write_depfile(out, std::string{depfile_target ? *depfile_target : output}, deps);
+        }
+        if (dep_graph) {
+            std::ofstream out{std::string{*dep_graph}};
+            write_dependency_graph(out, deps);
+        } else if (!depfile) {
+            write_dependency_graph(std::cout, deps);
+        }
+        return 0;
+    }
+
+    std::vector<module_interface> interfaces;
+    for (auto path : import_paths)
+        interfaces.push_back(module_interface::load(path));
+    symbol_table imports;
+    for (const auto &interface : interfaces)
+        imports.import(interface);
+
+    source_manager sources;
+    std::vector<check_unit> units;
+    for (auto file : input_files)
+        units.push_back(check_unit{file});
+    std::vector<pipeline_stage<check_unit>> stages{
+        {"check", jobs, [&](check_unit &unit) { check_unit_file(unit, sources, imports); }},
+    };
+    run_pipeline(units, stages, jobs);
+
+    // The first failing input decides the exit status, whichever thread finished first
+    int status = 0;
+    for (const auto &unit : units) {
+        std::cout << unit.out << std::flush;
+        std::cerr << unit.err << std::flush;
+        if (unit.exception)
+            std::rethrow_exception(unit.exception);
+        if (unit.status && !status)
+            status = unit.status;
+    }
+    return status;
+}
+
+int run_check(const std::vector<std::string_view> &args) {
+    try {
+        return check(args);
+    } catch (const compiler_exit &exit) {
+        return exit.status;
+    }
+}
+
+}
@@ -0,0 +1,18 @@
+#ifndef CANNON_CHECK_HPP
+#define CANNON_CHECK_HPP
+
+#include <string_view>
+#include <vector>
+
+namespace cannon {
+
+// The compiler's front-end-only modes, --check and --deps, for cannon-check. It is built on
+// libcannon-frontend alone, so it starts without LLVM's code generators or lld, for editor-save and
+// pre-commit checks. It takes the options of those two modes as run_driver does (inputs, --deps,
+// -MF, -MT, --dep-graph=, -o, --import, -j); any other option is an error, since it would need a
+// full compiler. Returns the exit status.
+int run_check(const std::vector<std::string_view> &args);
+
+}
+
+#endif // CANNON_CHECK_HPP
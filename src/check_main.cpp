@@ -0,0 +1,9 @@
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string_view> args(argv, argv + argc);
+    return cannon::run_check(args);
+}
@@ -1,36 +1,109 @@
 #include "codegen.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <map>
+#include <sstream>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/FileSystem.h>
-#include <llvm/Support/Host.h>
-#include <llvm/Support/TargetRegistry.h>
-#include <llvm/Support/TargetSelect.h>
-#include <llvm/Target/TargetMachine.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TimeProfiler.h>
+#if LLVM_VERSION_MAJOR >= 16
+#include <llvm/Support/VirtualFileSystem.h>
+#endif
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+#include "multiversion.hpp"
+#include "stats.hpp"
 
 namespace cannon {
 
-std::string mangle(const function &fn) {
-    std::string result = "_C";
-    result += std::to_string(fn.name().size());
-    result += fn.name();
-    result += "v"; // All functions have no parameters; don't ask too many questions.
-    return result;
+#if LLVM_VERSION_MAJOR >= 14
+using llvm_optimization_level = llvm::OptimizationLevel;
+#else
+using llvm_optimization_level = llvm::PassBuilder::OptimizationLevel;
+#endif
+
+using function_map = std::map<std::string, std::pair<llvm::Function*, const std::unique_ptr<function>*>>;
+
+unsigned llvm_opt_level(optimization_level level) {
+    switch (level) {
+      case optimization_level::Debug:
+        return 1;
+      case optimization_level::Size:
+      case optimization_level::Zize:
+        return 2;
+      case optimization_level::Fast:
+      case optimization_level::Extra:
+        return 3;
+      default:
+        return std::min(static_cast<unsigned>(level), 3u);
+    }
+}
+
+static llvm_optimization_level pipeline_level(optimization_level level) {
+    switch (level) {
+      case optimization_level::Size:
+        return llvm_optimization_level::Os;
+      case optimization_level::Zize:
+        return llvm_optimization_level::Oz;
+      default:
+        break;
+    }
+    switch (llvm_opt_level(level)) {
+      case 0:
+        return llvm_optimization_level::O0;
+      case 1:
+        return llvm_optimization_level::O1;
+      case 2:
+        return llvm_optimization_level::O2;
+      default:
+        return llvm_optimization_level::O3;
+    }
+}
+
+static llvm::CodeGenOpt::Level backend_level(optimization_level level) {
+    switch (llvm_opt_level(level)) {
+      case 0:
+        return llvm::CodeGenOpt::None;
+      case 1:
+        return llvm::CodeGenOpt::Less;
+      case 2:
+        return llvm::CodeGenOpt::Default;
+      default:
+        return llvm::CodeGenOpt::Aggressive;
+    }
 }
 
-llvm::Value* codegen_expr(const expression &expr, llvm::LLVMContext &context, llvm::IRBuilder<> &builder, std::map<std::string, std::pair<llvm::Function*, const std::unique_ptr<function>*>> functions) {
+// What each expression of the function being emitted evaluated to, for reuse_expression
+using value_map = std::unordered_map<const expression*, llvm::Value*>;
+
+llvm::Value* codegen_expr(const expression &expr, llvm::LLVMContext &context, llvm::IRBuilder<> &builder, function_map &functions, value_map &values);
+
+static llvm::Value* codegen_value(const expression &expr, llvm::LLVMContext &context, llvm::IRBuilder<> &builder, function_map &functions, value_map &values) {
     if(const binary_expression *bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
-        llvm::Value *lhs = codegen_expr(bin_expr->lhs(), context, builder, functions);
-        llvm::Value *rhs = codegen_expr(bin_expr->rhs(), context, builder, functions);
+        llvm::Value *lhs = codegen_expr(bin_expr->lhs(), context, builder, functions, values);
+        llvm::Value *rhs = codegen_expr(bin_expr->rhs(), context, builder, functions, values);
         switch(bin_expr->op()) {
           case ADD:
             return builder.CreateAdd(lhs, rhs);
@@ -46,87 +119,365 @@ llvm::Value* codegen_expr(const expression &expr, llvm::LLVMContext &context, ll
     } else if(const integer_expression *int_expr = dynamic_cast<const integer_expression*>(&expr)) {
         return llvm::ConstantInt::get(context, llvm::APInt(32, int_expr->value() & 0x00000000FFFFFFFFULL, true));
     } else if(const function_call_expression *fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
-        return builder.CreateCall(llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false), codegen_expr(fn_expr->func(), context, builder, functions), std::vector<llvm::Value*>(), std::vector<llvm::OperandBundleDef>());
+        return builder.CreateCall(llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false), codegen_expr(fn_expr->func(), context, builder, functions, values), std::vector<llvm::Value*>(), std::vector<llvm::OperandBundleDef>());
+    } else if(const reuse_expression *reuse_expr = dynamic_cast<const reuse_expression*>(&expr)) {
+        // Evaluation is left to right, so the original has always been emitted by now
+        return values.at(&reuse_expr->original());
     } else if(const identifier_expression *id_expr = dynamic_cast<const identifier_expression*>(&expr)) {
         // Fun.
         // So, for now, we're assuming identifiers refer to functions. This'll be dealt with in semantic analysis eventually.
         // Also, semantic analysis will make it so we know which function is being referred to instead of having to assume signature as always
-        return functions[std::string("_C") + std::to_string(id_expr->value().size()) + id_expr->value() + "v"].first;
+        std::string name = !id_expr->symbol().empty() ? id_expr->symbol()
+            : std::string("_C") + std::to_string(id_expr->value().size()) + std::string{id_expr->value()} + "v";
+        auto &entry = functions[name];
+        if (!entry.first) {
+            // Not defined in this file, so declare it and leave it to the linker (or ThinLTO) to find,
+            // unless a function added to the module earlier already did
+            auto *module = builder.GetInsertBlock()->getModule();
+            entry.first = module->getFunction(name);
+            if (!entry.first) {
+                auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false);
+                entry.first = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, module);
+            }
+        }
+        return entry.first;
     } else {
-        std::cerr << "Heh. Heh." << std::endl;
+        compiler_err() << "Heh. Heh." << std::endl;
         return nullptr;
     }
 }
 
-llvm::Value* codegen_function_body(const std::vector<std::unique_ptr<statement>> &statements, llvm::LLVMContext &context, llvm::IRBuilder<> &builder, std::map<std::string, std::pair<llvm::Function*, const std::unique_ptr<function>*>> functions) {
+llvm::Value* codegen_expr(const expression &expr, llvm::LLVMContext &context, llvm::IRBuilder<> &builder, function_map &functions, value_map &values) {
+    llvm::Value *value = codegen_value(expr, context, builder, functions, values);
+    values[&expr] = value;
+    return value;
+}
+
+llvm::Value* codegen_function_body(const std::vector<std::unique_ptr<statement>> &statements, llvm::LLVMContext &context, llvm::IRBuilder<> &builder, function_map &functions) {
     // FIXME: So, for now, I'm assuming there's only one expr. Because there is only one expr.
-    return codegen_expr(*(dynamic_cast<expression*>(&(*statements[0]))), context, builder, functions); // Uh, this statement is garbage
+    value_map values;
+    return codegen_expr(*(dynamic_cast<expression*>(&(*statements[0]))), context, builder, functions, values); // Uh, this statement is garbage
 }
 
-void codegen(program p, std::string output_file) {
-    llvm::LLVMContext context;
-    llvm::Module module("Cannon Bootstrap Compiler", context);
+std::unique_ptr<llvm::Module> create_module(llvm::LLVMContext &context, llvm::TargetMachine &targetMachine) {
+    auto module = std::make_unique<llvm::Module>("Cannon Bootstrap Compiler", context);
+    module->setDataLayout(targetMachine.createDataLayout());
+    module->setTargetTriple(targetMachine.getTargetTriple().str());
+    return module;
+}
+
+// The symbol `f_p` is emitted as, which for main is main itself
+static std::string symbol_name(const function &f_p) {
+    // All valid `main` functions have the same signature. All invalid `main` functions don't exist, NDR.
+    return f_p.name() == "main" ? std::string("main") : mangle(f_p);
+}
 
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
+static void define_function(llvm::Function *definition, const function &f_p, llvm::IRBuilder<> &builder, function_map &functions) {
+    llvm::TimeTraceScope function_trace{"Emit function", f_p.name()};
+    llvm::BasicBlock *block = llvm::BasicBlock::Create(builder.getContext(), "entry", definition);
+    builder.SetInsertPoint(block);
+    builder.CreateRet(codegen_function_body(f_p.statements(), builder.getContext(), builder, functions));
+    llvm::verifyFunction(*definition);
+}
+
+std::unique_ptr<llvm::Module> build_module(const program &p, llvm::LLVMContext &context, llvm::TargetMachine &targetMachine,
+        const function *only) {
+    llvm::TimeTraceScope trace{"Emit IR"};
+    auto module = create_module(context, targetMachine);
+
+    function_map functions;
+    std::vector<llvm::Function*> definitions;
+
+    for(const std::unique_ptr<function> &f_p : p.functions()) {
+        // FIXME: Currently assuming all functions return i32 and take no parameters.
+        auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false);
+        std::string name = symbol_name(*f_p);
+        auto definition = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, *module);
+        functions[name] = std::pair<llvm::Function*, const std::unique_ptr<function>*>(definition, &f_p);
+        definitions.push_back(definition);
+    }
+
+    llvm::IRBuilder<> builder(context);
+    for(std::size_t i = 0; i < definitions.size(); i++) {
+        auto &f_p = p.functions()[i];
+        if (only && f_p.get() != only)
+            continue;
+        define_function(definitions[i], *f_p, builder, functions);
+    }
+
+    return module;
+}
 
-    std::string targetTriple = llvm::sys::getDefaultTargetTriple();
-    module.setTargetTriple(targetTriple);
+void add_function(llvm::Module &module, const function &fn) {
+    auto &context = module.getContext();
+    std::string name = symbol_name(fn);
+    // Earlier functions may have declared it by calling it
+    llvm::Function *definition = module.getFunction(name);
+    if (!definition)
+        definition = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false),
+            llvm::Function::ExternalLinkage, name, module);
+    function_map functions;
+    llvm::IRBuilder<> builder(context);
+    define_function(definition, fn, builder, functions);
+}
 
-    std::string error;
-    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
-    if(!target) {
-        std::cerr << "Failed to start codegen: " << error << std::endl;
-        abort();
+#if LLVM_VERSION_MAJOR >= 16
+using optional_pgo_options = std::optional<llvm::PGOOptions>;
+#else
+using optional_pgo_options = llvm::Optional<llvm::PGOOptions>;
+#endif
+
+static optional_pgo_options pgo_options(const codegen_options &options) {
+    std::string file;
+    auto action = llvm::PGOOptions::NoAction;
+    if (!options.profile_generate.empty()) {
+        file = options.profile_generate;
+        action = llvm::PGOOptions::IRInstr;
+    } else if (!options.profile_use.empty()) {
+        file = options.profile_use;
+        action = llvm::PGOOptions::IRUse;
+    } else {
+        return {};
     }
-    llvm::TargetOptions options;
-    llvm::Optional<llvm::Reloc::Model> rm = llvm::Optional<llvm::Reloc::Model>();
-    llvm::TargetMachine *targetMachine = target->createTargetMachine(targetTriple, "generic", "", options, rm);
+#if LLVM_VERSION_MAJOR >= 17
+    return llvm::PGOOptions{file, "", "", "", llvm::vfs::getRealFileSystem(), action};
+#elif LLVM_VERSION_MAJOR >= 16
+    return llvm::PGOOptions{file, "", "", llvm::vfs::getRealFileSystem(), action};
+#else
+    return llvm::PGOOptions{file, "", "", action};
+#endif
+}
+
+// Passes LLVM's own diagnostics, like profile mismatches, on to report(). Errors are counted, so
+// that optimize_module can stop once the passes are done.
+static void report_llvm_diagnostic(const llvm::DiagnosticInfo &info, void *errors) {
+    if (info.getSeverity() == llvm::DS_Remark || info.getSeverity() == llvm::DS_Note)
+        return;
+    std::string message;
+    llvm::raw_string_ostream stream{message};
+    llvm::DiagnosticPrinterRawOStream printer{stream};
+    info.print(printer);
+    stream.flush();
+    bool error = info.getSeverity() == llvm::DS_Error;
+    if (error)
+        ++*static_cast<unsigned *>(errors);
+    report({error ? diagnostic_level::Error : diagnostic_level::Warning, {}, 0, 0, message});
+}
 
-    module.setDataLayout(targetMachine->createDataLayout());
-    module.setTargetTriple(targetTriple);
+// Sends a context's diagnostics to report_llvm_diagnostic while it lives, counting errors, and
+// puts the context's own handler back when it goes
+class diagnostic_scope {
+  private:
+    llvm::LLVMContext &m_context;
+    std::unique_ptr<llvm::DiagnosticHandler> m_previous;
+  public:
+    unsigned errors{0};
 
-    std::error_code errorCode;
-    llvm::raw_fd_ostream dest(output_file, errorCode);
-    if(errorCode) {
-        std::cerr << "Failed to open output file: " << errorCode.message() << std::endl;
-        abort();
+    explicit diagnostic_scope(llvm::LLVMContext &context) : m_context(context), m_previous(context.getDiagnosticHandler()) {
+        // Taking the old handler leaves the context without one, so this one is a whole handler
+        auto handler = std::make_unique<llvm::DiagnosticHandler>(&errors);
+        handler->DiagHandlerCallback = report_llvm_diagnostic;
+        m_context.setDiagnosticHandler(std::move(handler));
     }
+    ~diagnostic_scope() {
+        m_context.setDiagnosticHandler(std::move(m_previous));
+    }
+    diagnostic_scope(const diagnostic_scope &) = delete;
+    diagnostic_scope &operator=(const diagnostic_scope &) = delete;
+};
+
+void optimize_module(llvm::Module &module, llvm::TargetMachine &targetMachine, const codegen_options &options) {
+    llvm::TimeTraceScope trace{"Optimize"};
+    diagnostic_scope diagnostics{module.getContext()};
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+
+    llvm::PassBuilder builder(&targetMachine, llvm::PipelineTuningOptions{}, pgo_options(options));
+    builder.registerModuleAnalyses(mam);
+    builder.registerCGSCCAnalyses(cgam);
+    builder.registerFunctionAnalyses(fam);
+    builder.registerLoopAnalyses(lam);
+    builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+    auto level = pipeline_level(options.opt_level);
+    bool thin = options.lto == lto_mode::Thin;
+    llvm::ModulePassManager passes;
+    if (level == llvm_optimization_level::O0)
+        passes = builder.buildO0DefaultPipeline(level, thin);
+    else if (thin)
+        passes = builder.buildThinLTOPreLinkDefaultPipeline(level);
+    else if (!options.multiversion.empty()) {
+        passes.addPass(builder.buildModuleSimplificationPipeline(level, llvm::ThinOrFullLTOPhase::None));
+        passes.addPass(multiversion_pass{options.multiversion});
+#if LLVM_VERSION_MAJOR >= 17
+        passes.addPass(builder.buildModuleOptimizationPipeline(level, llvm::ThinOrFullLTOPhase::None));
+#else
+        passes.addPass(builder.buildModuleOptimizationPipeline(level));
+#endif
+    } else
+        passes = builder.buildPerModuleDefaultPipeline(level);
+    passes.run(module, mam);
+    if (diagnostics.errors)
+        throw compiler_exit{1};
+}
+
+void emit_object(llvm::Module &module, llvm::TargetMachine &targetMachine, const codegen_options &options, llvm::raw_pwrite_stream &dest) {
+    llvm::TimeTraceScope trace{"Emit object"};
+    targetMachine.setOptLevel(backend_level(options.opt_level));
 
     llvm::legacy::PassManager pass;
-    if(targetMachine->addPassesToEmitFile(pass, dest, nullptr, llvm::CGFT_ObjectFile)) {
-        std::cerr << "Can't emit object file!" << std::endl;
-        abort();
+    if(targetMachine.addPassesToEmitFile(pass, dest, nullptr, llvm::CGFT_ObjectFile)) {
+        report({diagnostic_level::Error, {}, 0, 0, "Can't emit object file!"});
+        throw compiler_exit{1};
     }
 
-    std::map<std::string, std::pair<llvm::Function*, const std::unique_ptr<function>*>> functions;
+    pass.run(module);
+}
 
-    for(const std::unique_ptr<function> &f_p : p.functions()) {
-        std::string name;
-        llvm::FunctionType *type;
-        if(f_p->name() == "main") {
-            // All valid `main` functions have the same signature. All invalid `main` functions don't exist, NDR.
-            type = llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false);
-            name = std::string("main");
-        } else {
-            // FIXME: Currently assuming all functions return i32 and take no parameters.
-            type = llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false);
-            name = mangle(*f_p);
-        }
-        functions[name] = std::pair<llvm::Function*, const std::unique_ptr<function>*>(llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, module), &f_p);
+void emit_bitcode(const llvm::Module &module, const codegen_options &options, llvm::raw_ostream &dest) {
+    llvm::TimeTraceScope trace{"Emit bitcode"};
+    if (options.lto == lto_mode::Thin) {
+        // No profile data, so there are no block frequencies to feed the summary
+        llvm::ProfileSummaryInfo profile_summary{module};
+        llvm::ModuleSummaryIndex index = llvm::buildModuleSummaryIndex(module,
+            [](const llvm::Function &) -> llvm::BlockFrequencyInfo * { return nullptr; }, &profile_summary);
+        // The module hash is what keys the ThinLTO cache
+        llvm::WriteBitcodeToFile(module, dest, false, &index, true);
+    } else {
+        llvm::WriteBitcodeToFile(module, dest);
+    }
+}
+
+std::unique_ptr<llvm::Module> load_ir(llvm::MemoryBufferRef ir, llvm::LLVMContext &context, llvm::TargetMachine &targetMachine) {
+    llvm::SMDiagnostic error;
+    auto module = llvm::parseIR(ir, error, context);
+    if (!module) {
+        auto line = static_cast<std::uint64_t>(std::max(error.getLineNo(), 0));
+        auto column = static_cast<std::uint32_t>(line ? error.getColumnNo() + 1 : 0);
+        report({diagnostic_level::Error, ir.getBufferIdentifier().str(), line, column, error.getMessage().str()});
+        throw compiler_exit{1};
+    }
+    if (llvm::Triple{module->getTargetTriple()} != targetMachine.getTargetTriple()) {
+        report({diagnostic_level::Error, ir.getBufferIdentifier().str(), 0, 0, "Compiled for " + module->getTargetTriple()
+            + ", not " + targetMachine.getTargetTriple().str()});
+        throw compiler_exit{1};
     }
+    return module;
+}
 
-    llvm::IRBuilder<> builder(context);
-    for(auto const &[name, pair] : functions) {
-        auto function = pair.first;
-        auto &f_p = *pair.second;
-        llvm::BasicBlock *block = llvm::BasicBlock::Create(context, "entry", function);
-        builder.SetInsertPoint(block);
-        builder.CreateRet(codegen_function_body(f_p->statements(), context, builder, functions));
-        llvm::verifyFunction(*function);
+// Writes an optimized `module` in the form options.emit asks for
+static void emit_module(llvm::Module &module, llvm::TargetMachine &targetMachine, const codegen_options &options, llvm::raw_pwrite_stream &dest) {
+    switch (options.emit) {
+      case emit_kind::Object:
+        emit_object(module, targetMachine, options, dest);
+        break;
+      case emit_kind::Bitcode:
+        emit_bitcode(module, options, dest);
+        break;
+      case emit_kind::IRText:
+        module.print(dest, nullptr);
+        break;
     }
+    dest.flush();
+}
 
-    pass.run(module);
+void codegen_module(llvm::Module &module, llvm::raw_pwrite_stream &dest, llvm::TargetMachine &targetMachine, const codegen_options &options) {
+    optimize_module(module, targetMachine, options);
+    if (options.stats)
+        options.stats->add_llvm_instructions(module.getInstructionCount());
+
+    emit_module(module, targetMachine, options, dest);
+}
+
+void codegen(const program &p, llvm::raw_pwrite_stream &dest, llvm::TargetMachine &targetMachine, const codegen_options &options) {
+    llvm::LLVMContext context;
+    auto module = build_module(p, context, targetMachine);
+    codegen_module(*module, dest, targetMachine, options);
+}
+
+// Maps each function `expr` calls by name to the symbol it resolved to, if an import chose one
+static void collect_callees(const expression &expr, std::map<std::string, std::string> &callees) {
+    if (auto bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
+        collect_callees(bin_expr->lhs(), callees);
+        collect_callees(bin_expr->rhs(), callees);
+    } else if (auto fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
+        if (auto id_expr = dynamic_cast<const identifier_expression*>(&fn_expr->func()))
+            callees.emplace(id_expr->value(), id_expr->symbol());
+        else
+            collect_callees(fn_expr->func(), callees);
+        for (const auto &param : fn_expr->params())
+            collect_callees(*param, callees);
+    }
+}
+
+std::string function_fingerprint(const program &p, const function &fn) {
+    std::ostringstream result;
+    result << fn << '\n';
+    std::map<std::string, std::string> callees;
+    for (const auto &statement : fn.statements())
+        if (auto expr = dynamic_cast<const expression*>(statement.get()))
+            collect_callees(*expr, callees);
+    // A callee defined in this file is known by its signature; any other by the symbol it resolved
+    // to. What an imported one's signature is comes from the interfaces, which the cache key covers.
+    std::map<std::string_view, const function*> local;
+    for (const auto &f : p.functions())
+        local.emplace(f->name(), f.get());
+    for (const auto &[callee, symbol] : callees) {
+        result << "calls " << callee << ": ";
+        if (auto it = local.find(callee); it != local.end())
+            result << mangle(*it->second) << " -> " << it->second->return_type();
+        else
+            result << "extern " << (symbol.empty() ? callee : symbol);
+        result << '\n';
+    }
+    return result.str();
+}
+
+void codegen_incremental(const program &p, llvm::raw_pwrite_stream &dest, llvm::TargetMachine &targetMachine,
+        const codegen_options &options, const function_cache &cache) {
+    llvm::LLVMContext context;
+    auto module = create_module(context, targetMachine);
+    llvm::Linker linker{*module};
+
+    for (const auto &fn : p.functions()) {
+        auto fingerprint = function_fingerprint(p, *fn);
+        auto bitcode = cache.lookup(fingerprint);
+        if (!bitcode) {
+            llvm::LLVMContext function_context;
+            auto piece = build_module(p, function_context, targetMachine, fn.get());
+            optimize_module(*piece, targetMachine, options);
+            llvm::SmallVector<char, 0> buffer;
+            llvm::raw_svector_ostream stream{buffer};
+            llvm::WriteBitcodeToFile(*piece, stream);
+            llvm::StringRef contents{buffer.data(), buffer.size()};
+            cache.insert(fingerprint, contents);
+            bitcode = llvm::MemoryBuffer::getMemBufferCopy(contents, fn->name());
+        }
+        llvm::TimeTraceScope trace{"Link function", fn->name()};
+        auto piece = llvm::parseBitcodeFile(bitcode->getMemBufferRef(), context);
+        if (!piece) {
+            report({diagnostic_level::Error, {}, 0, 0, "Cached code for " + fn->name() + " is unreadable: "
+                + llvm::toString(piece.takeError())});
+            throw compiler_exit{1};
+        }
+        if (linker.linkInModule(std::move(*piece))) {
+            report({diagnostic_level::Error, {}, 0, 0, "Failed to link the code for " + fn->name()});
+            throw compiler_exit{1};
+        }
+    }
+    if (options.stats)
+        options.stats->add_llvm_instructions(module->getInstructionCount());
+
+    emit_module(*module, targetMachine, options, dest);
+}
+
+void codegen_ir(llvm::MemoryBufferRef ir, llvm::raw_pwrite_stream &dest, llvm::TargetMachine &targetMachine, const codegen_options &options) {
+    llvm::LLVMContext context;
+    auto module = load_ir(ir, context, targetMachine);
+    // The middle-end already ran when the IR was written
+    emit_object(*module, targetMachine, options, dest);
     dest.flush();
 }
 
@@ -1,11 +1,90 @@
 #ifndef CANNON_CODEGEN_HPP
 #define CANNON_CODEGEN_HPP
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "mode.hpp"
 #include "program.hpp"
 
 namespace cannon {
 
-void codegen(program p, std::string out_file);
+class compile_stats;
+
+struct codegen_options {
+    optimization_level opt_level{0};
+    lto_mode lto{lto_mode::None};
+    emit_kind emit{emit_kind::Object};
+    compile_stats *stats{nullptr}; // -fstats, which doesn't change the output
+    // -fprofile-generate: where instrumented programs write their raw profile (%m etc. as in clang)
+    std::string profile_generate{};
+    // -fprofile-use: the indexed profile (.profdata) to optimize with
+    std::string profile_use{};
+    // -fmultiversion: the CPUs hot functions get extra versions for, picked between at run time
+    std::vector<std::string> multiversion{};
+};
+
+// The 0-3 level LLVM's own tools would use for `level`
+unsigned llvm_opt_level(optimization_level level);
+
+// Builds IR for `p`. With `only`, just that function gets a body and the rest are declared.
+std::unique_ptr<llvm::Module> build_module(const program &p, llvm::LLVMContext &context, llvm::TargetMachine &target_machine,
+    const function *only = nullptr);
+
+// An empty module for `target_machine`, for add_function to fill
+std::unique_ptr<llvm::Module> create_module(llvm::LLVMContext &context, llvm::TargetMachine &target_machine);
+
+// Adds the body of `fn` to `module`, for modules built a function at a time. Its callees are only
+// referred to by symbol, so they can be added before or after it, or not at all.
+void add_function(llvm::Module &module, const function &fn);
+
+// Runs the middle-end pipeline for the -O level. With ThinLTO the pre-link pipeline is used instead,
+// leaving cross-module work to the link step. Profile instrumentation or profile data are added
+// first, when the options ask for them; problems matching a profile are reported as warnings.
+// Multiversioning happens between the simplification and optimization halves of the pipeline, and
+// not at all at -O0 or under ThinLTO, whose optimization half runs at link time.
+void optimize_module(llvm::Module &module, llvm::TargetMachine &target_machine, const codegen_options &options);
+
+void emit_object(llvm::Module &module, llvm::TargetMachine &target_machine, const codegen_options &options, llvm::raw_pwrite_stream &out);
+
+// Writes `module` as bitcode, with a ThinLTO summary index when options.lto asks for one
+void emit_bitcode(const llvm::Module &module, const codegen_options &options, llvm::raw_ostream &out);
+
+// Reads .bc or .ll contents written by --compile-only, so that its object can be emitted later
+std::unique_ptr<llvm::Module> load_ir(llvm::MemoryBufferRef ir, llvm::LLVMContext &context, llvm::TargetMachine &target_machine);
+
+// Optimizes `module` and writes it to `out` in the form options.emit asks for
+void codegen_module(llvm::Module &module, llvm::raw_pwrite_stream &out, llvm::TargetMachine &target_machine, const codegen_options &options);
+
+// Writes `p` to `out` in the form options.emit asks for
+void codegen(const program &p, llvm::raw_pwrite_stream &out, llvm::TargetMachine &target_machine, const codegen_options &options);
+
+// Where codegen_incremental keeps the optimized bitcode of single functions, by fingerprint
+struct function_cache {
+    std::function<std::unique_ptr<llvm::MemoryBuffer>(const std::string &fingerprint)> lookup;
+    std::function<void(const std::string &fingerprint, llvm::StringRef bitcode)> insert;
+};
+
+// Everything the optimized IR of `fn` depends on besides the target, options and imports: its HIR,
+// the signatures of the functions it calls from the same file and the symbols of the others
+std::string function_fingerprint(const program &p, const function &fn);
+
+// Like codegen, but each function is optimized on its own, so that only functions whose
+// fingerprints changed are rebuilt; the rest come from `cache`. The pieces are linked into one
+// module before the backend runs. Functions can't be inlined into each other this way.
+void codegen_incremental(const program &p, llvm::raw_pwrite_stream &out, llvm::TargetMachine &target_machine,
+    const codegen_options &options, const function_cache &cache);
+
+// Runs only the machine backend over IR from an earlier --compile-only run
+void codegen_ir(llvm::MemoryBufferRef ir, llvm::raw_pwrite_stream &out, llvm::TargetMachine &target_machine, const codegen_options &options);
 
 }
 
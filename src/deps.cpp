@@ -0,0 +1,154 @@
+#include "deps.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_os_ostream.h>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+#include "lex.hpp"
+#include "pipeline.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+file_dependencies scan_items(std::string file, const std::vector<token> &tokens) {
+    file_dependencies result{std::move(file)};
+    std::set<std::string> definitions;
+    std::set<std::string> references;
+
+    // Only `fn <name>` at the top level and `<name>(` inside bodies matter; everything else is skipped
+    int depth = 0;
+    for (std::size_t i = 0; i < tokens.size(); i++) {
+        auto text = tokens[i].get_text();
+        if (text == "{"sv) {
+            depth++;
+        } else if (text == "}"sv) {
+            depth--;
+        } else if (tokens[i].get_type() == IDENTIFIER && i + 1 < tokens.size()) {
+            if (depth == 0 && text == "fn"sv && tokens[i + 1].get_type() == IDENTIFIER)
+                definitions.emplace(tokens[++i].get_text());
+            else if (depth > 0 && tokens[i + 1].get_text() == "("sv)
+                references.emplace(text);
+        }
+    }
+
+    result.definitions.assign(definitions.begin(), definitions.end());
+    std::set_difference(references.begin(), references.end(), definitions.begin(), definitions.end(),
+        std::back_inserter(result.references));
+    return result;
+}
+
+std::vector<file_dependencies> scan_dependencies(const std::vector<std::string> &files, unsigned jobs, bool quiet) {
+    std::vector<file_dependencies> result(files.size());
+    std::vector<std::exception_ptr> errors(files.size());
+    std::vector<std::string> messages(files.size());
+    {
+        source_manager sources;
+        // Files are scanned independently, so this is a pipeline of one stage
+        std::vector<std::size_t> indices(files.size());
+        for (std::size_t i = 0; i < files.size(); i++)
+            indices[i] = i;
+        auto threads = static_cast<unsigned>(std::min<std::size_t>(jobs ? jobs : default_jobs(), std::max<std::size_t>(files.size(), 1)));
+        std::vector<pipeline_stage<std::size_t>> stages{
+            {"scan", threads, [&](std::size_t &i) {
+                diagnostic_buffer buffer;
+                diagnostic_context context{files[i], nullptr, &sources};
+                try {
+                    auto source = llvm::MemoryBuffer::getFile(files[i]);
+                    if (!source) {
+                        report({diagnostic_level::Error, files[i], 0, 0, "Cannot open: " + source.getError().message()});
+                        throw compiler_exit{1};
+                    }
+                    result[i] = scan_items(files[i], lex(sources.add(files[i], std::move(*source))).tokens);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+                messages[i] = buffer.err();
+            }},
+        };
+        run_pipeline(indices, stages, files.size());
+    }
+
+    // Report the first failure in input order, like a serial scan would
+    for (std::size_t i = 0; i < files.size(); i++) {
+        if (!quiet)
+            std::cerr << messages[i];
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+    }
+    return result;
+}
+
+// Make treats spaces, '#' and '$' specially in rules
+static std::string escape_make(std::string_view path) {
+    std::string result;
+    for (char c : path) {
+        if (c == ' ' || c == '#' || c == '\\')
+            result.push_back('\\');
+        else if (c == '$')
+            result.push_back('$');
+        result.push_back(c);
+    }
+    return result;
+}
+
+void write_depfile(std::ostream &out, const std::string &target, const std::vector<file_dependencies> &files) {
+    out << escape_make(target) << ":";
+    for (auto &file : files)
+        out << " \\\n  " << escape_make(file.file);
+    out << "\n";
+}
+
+void write_dependency_graph(std::ostream &out, const std::vector<file_dependencies> &files) {
+    std::map<std::string_view, std::set<std::string_view>> definers;
+    for (auto &file : files)
+        for (auto &definition : file.definitions)
+            definers[definition].insert(file.file);
+
+    llvm::raw_os_ostream stream{out};
+    llvm::json::OStream json{stream, 2};
+    auto strings = [&](llvm::StringRef name, auto &&values) {
+        json.attributeArray(name, [&] {
+            for (auto &value : values)
+                json.value(llvm::StringRef{value.data(), value.size()});
+        });
+    };
+
+    json.object([&] {
+        json.attributeArray("files", [&] {
+            for (auto &file : files) {
+                std::set<std::string_view> depends_on;
+                std::vector<std::string_view> unresolved;
+                for (auto &reference : file.references) {
+                    auto it = definers.find(reference);
+                    if (it == definers.end())
+                        unresolved.push_back(reference);
+                    else
+                        depends_on.insert(it->second.begin(), it->second.end());
+                }
+                depends_on.erase(file.file);
+
+                json.object([&] {
+                    json.attribute("file", file.file);
+                    strings("defines", file.definitions);
+                    strings("references", file.references);
+                    strings("depends-on", depends_on);
+                    strings("unresolved", unresolved);
+                });
+            }
+        });
+    });
+    stream << "\n";
+}
+
+}
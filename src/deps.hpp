@@ -0,0 +1,36 @@
+#ifndef CANNON_DEPS_HPP
+#define CANNON_DEPS_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "token.hpp"
+
+namespace cannon {
+
+// What one source file provides and needs, as found by the item pre-parse: the functions it
+// defines, and the functions it calls that it doesn't define itself
+struct file_dependencies {
+    std::string file;
+    std::vector<std::string> definitions;
+    std::vector<std::string> references;
+};
+
+// Scans top-level items without building an AST, so malformed function bodies are not diagnosed
+file_dependencies scan_items(std::string file, const std::vector<token> &tokens);
+
+// Lexes and scans every file, `jobs` at a time (0 picks one per hardware thread). Messages come out
+// in input order, unless `quiet` drops them for a caller that will diagnose the files itself.
+std::vector<file_dependencies> scan_dependencies(const std::vector<std::string> &files, unsigned jobs, bool quiet = false);
+
+// Make/Ninja depfile: `target` depends on every input
+void write_depfile(std::ostream &out, const std::string &target, const std::vector<file_dependencies> &files);
+
+// JSON graph: per file, its definitions, references, the files that resolve them, and the
+// references that no input defines
+void write_dependency_graph(std::ostream &out, const std::vector<file_dependencies> &files);
+
+}
+
+#endif // CANNON_DEPS_HPP
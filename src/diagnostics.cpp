@@ -0,0 +1,99 @@
+#include "diagnostics.hpp"
+
+#include <charconv>
+
+#include "error.hpp"
+
+namespace cannon {
+
+static thread_local std::ostream *current_out = &std::cout;
+static thread_local std::ostream *current_err = &std::cerr;
+static thread_local std::string_view current_file{};
+static thread_local std::vector<diagnostic> *current_collector = nullptr;
+static thread_local const source_manager *current_sources = nullptr;
+
+std::ostream &compiler_out() {
+    return *current_out;
+}
+
+std::ostream &compiler_err() {
+    return *current_err;
+}
+
+std::ostream &operator<<(std::ostream &os, const diagnostic &d) {
+    if (!d.file.empty())
+        os << d.file << ":";
+    if (d.line)
+        os << d.line << ":" << d.column << ":";
+    if (!d.file.empty() || d.line)
+        os << " ";
+    if (d.level == diagnostic_level::Warning)
+        os << "Warning: ";
+    return os << d.message;
+}
+
+presumed_location presume(source_location location) {
+    return current_sources ? current_sources->presume(location) : presumed_location{};
+}
+
+void report(diagnostic d) {
+    if (d.location && !d.line) {
+        auto where = presume(d.location);
+        if (where.line) {
+            d.file = std::string{where.file};
+            d.line = where.line;
+            d.column = where.column;
+        }
+    }
+    if (d.file.empty())
+        d.file = current_file;
+    compiler_err() << d << std::endl;
+    if (current_collector)
+        current_collector->push_back(std::move(d));
+}
+
+unsigned parse_count(std::string_view option, std::string_view value) {
+    unsigned result = 0;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc{} || end != value.data() + value.size()) {
+        report({diagnostic_level::Error, {}, 0, 0, std::string{option} + " takes a whole number, not \"" + std::string{value} + "\""});
+        throw compiler_exit{1};
+    }
+    return result;
+}
+
+diagnostic_context::diagnostic_context(std::string_view file, std::vector<diagnostic> *collector, const source_manager *sources)
+    : m_previous_file(current_file), m_previous_collector(current_collector), m_previous_sources(current_sources) {
+    current_file = file;
+    current_collector = collector;
+    current_sources = sources;
+}
+
+diagnostic_context::~diagnostic_context() {
+    current_file = m_previous_file;
+    current_collector = m_previous_collector;
+    current_sources = m_previous_sources;
+}
+
+diagnostic_redirect::diagnostic_redirect(std::ostream &out, std::ostream &err)
+    : m_previous_out(current_out), m_previous_err(current_err) {
+    current_out = &out;
+    current_err = &err;
+}
+
+diagnostic_redirect::~diagnostic_redirect() {
+    current_out = m_previous_out;
+    current_err = m_previous_err;
+}
+
+diagnostic_buffer::diagnostic_buffer() : m_redirect(m_out, m_err) {}
+
+std::string diagnostic_buffer::out() const {
+    return m_out.str();
+}
+
+std::string diagnostic_buffer::err() const {
+    return m_err.str();
+}
+
+}
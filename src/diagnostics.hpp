@@ -0,0 +1,96 @@
+#ifndef CANNON_DIAGNOSTICS_HPP
+#define CANNON_DIAGNOSTICS_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "source.hpp"
+
+namespace cannon {
+
+enum class diagnostic_level {
+    Error,
+    Warning,
+};
+
+// A problem found in the source. `line` and `column` are 1-based, and 0 when there is no location.
+// A `location` is turned into file, line and column when the diagnostic is reported.
+struct diagnostic {
+    diagnostic_level level{diagnostic_level::Error};
+    std::string file{};
+    std::uint64_t line{0};
+    std::uint32_t column{0};
+    std::string message{};
+    source_location location{0};
+};
+
+// file:line:column: message
+std::ostream &operator<<(std::ostream &os, const diagnostic &d);
+
+// Reports a problem in the file this thread is compiling: prints it to compiler_err(), and hands it
+// to the diagnostic_context's collector, if it has one. Fatal problems are then thrown as
+// compiler_exit by the caller.
+void report(diagnostic d);
+
+// The value of a numeric option such as -j, which has to be a whole number; reports and exits if
+// it isn't
+unsigned parse_count(std::string_view option, std::string_view value);
+
+// Names the file this thread is compiling, for the diagnostics reported while it lives, and
+// optionally collects them. `sources` resolves the locations they carry.
+class diagnostic_context {
+  private:
+    std::string_view m_previous_file;
+    std::vector<diagnostic> *m_previous_collector;
+    const source_manager *m_previous_sources;
+  public:
+    explicit diagnostic_context(std::string_view file, std::vector<diagnostic> *collector = nullptr,
+        const source_manager *sources = nullptr);
+    ~diagnostic_context();
+    diagnostic_context(const diagnostic_context &) = delete;
+    diagnostic_context &operator=(const diagnostic_context &) = delete;
+};
+
+// Where `location` is, according to the current diagnostic_context; empty if it doesn't know
+presumed_location presume(source_location location);
+
+// Where compiler output and diagnostics go: std::cout and std::cerr, unless the current thread has
+// redirected them
+std::ostream &compiler_out();
+std::ostream &compiler_err();
+
+// Sends this thread's compiler_out() and compiler_err() to other streams for as long as it lives
+class diagnostic_redirect {
+  private:
+    std::ostream *m_previous_out;
+    std::ostream *m_previous_err;
+  public:
+    diagnostic_redirect(std::ostream &out, std::ostream &err);
+    ~diagnostic_redirect();
+    diagnostic_redirect(const diagnostic_redirect &) = delete;
+    diagnostic_redirect &operator=(const diagnostic_redirect &) = delete;
+};
+
+// Collects this thread's compiler_out() and compiler_err() for as long as it lives, so that a
+// parallel build can print each file's messages in input order, whichever file finishes first
+class diagnostic_buffer {
+  private:
+    std::ostringstream m_out;
+    std::ostringstream m_err;
+    diagnostic_redirect m_redirect;
+  public:
+    diagnostic_buffer();
+    diagnostic_buffer(const diagnostic_buffer &) = delete;
+    diagnostic_buffer &operator=(const diagnostic_buffer &) = delete;
+
+    std::string out() const;
+    std::string err() const;
+};
+
+}
+
+#endif // CANNON_DIAGNOSTICS_HPP
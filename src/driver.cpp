@@ -0,0 +1,1089 @@
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string_view>
+#include <vector>
+
+#include <Config.hpp>
+
+#include "ast.hpp"
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "deps.hpp"
+#include "diagnostics.hpp"
+#include "driver.hpp"
+#include "error.hpp"
+#include "hir_passes.hpp"
+#include "lex.hpp"
+#include "link.hpp"
+#include "lto.hpp"
+#include "mode.hpp"
+#include "module_interface.hpp"
+#include "multiversion.hpp"
+#include "parser.hpp"
+#include "pipeline.hpp"
+#include "semantic.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "streaming.hpp"
+#include "target.hpp"
+#include "time_trace.hpp"
+#include "token.hpp"
+
+using namespace cannon;
+using namespace std::string_view_literals;
+
+// Picks the file written for one input. A lone input goes to `output`, but in a batch every input
+// gets its own file named after its stem, so that later inputs don't overwrite earlier ones. Two
+// inputs with the same stem would still collide, which the driver checks for up front.
+static std::string output_path_for(std::string_view input, std::string_view output,
+        const std::optional<std::string_view> &output_dir, bool batch, std::string_view extension) {
+    if (!output_dir && !batch)
+        return std::string{output};
+    std::filesystem::path result{std::filesystem::path{input}.stem()};
+    result += extension;
+    if (output_dir)
+        result = std::filesystem::path{*output_dir} / result;
+    return result.string();
+}
+
+// Writes the module interface for `programs` next to `artifact_path`, as a .tbd
+static void write_interface(const std::string &artifact_path, const std::vector<const program*> &programs) {
+    std::error_code errorCode;
+    llvm::raw_fd_ostream dest{std::filesystem::path{artifact_path}.replace_extension(".tbd").string(), errorCode};
+    if (errorCode) {
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to open module interface file: " + errorCode.message()});
+        throw compiler_exit{1};
+    }
+    write_module_interface(dest, programs);
+}
+
+static bool is_ir_file(std::string_view path) {
+    return path.ends_with(".bc"sv) || path.ends_with(".ll"sv);
+}
+
+// Maps the file rather than copying it, so that even a very large one costs little until it's read
+static std::unique_ptr<llvm::MemoryBuffer> read_source(std::string_view input_file) {
+    auto buffer = llvm::MemoryBuffer::getFile(input_file);
+    if (!buffer) {
+        report({diagnostic_level::Error, std::string{input_file}, 0, 0, "Cannot open: " + buffer.getError().message()});
+        throw compiler_exit{1};
+    }
+    return std::move(*buffer);
+}
+
+static std::unique_ptr<llvm::MemoryBuffer> read_ir(std::string_view input_file) {
+    auto buffer = llvm::MemoryBuffer::getFile(input_file);
+    if (!buffer) {
+        report({diagnostic_level::Error, std::string{input_file}, 0, 0, "Failed to read: " + buffer.getError().message()});
+        throw compiler_exit{1};
+    }
+    return std::move(*buffer);
+}
+
+program_cache::program_cache(std::size_t capacity) : m_capacity(capacity) {}
+
+std::shared_ptr<const program> program_cache::lookup(const std::string &key) const {
+    std::lock_guard lock{m_mutex};
+    auto it = m_programs.find(key);
+    return it == m_programs.end() ? nullptr : it->second;
+}
+
+void program_cache::insert(const std::string &key, std::shared_ptr<const program> p) {
+    std::lock_guard lock{m_mutex};
+    if (!m_programs.insert_or_assign(key, std::move(p)).second)
+        return;
+    m_order.push_back(key);
+    if (m_order.size() > m_capacity) {
+        m_programs.erase(m_order.front());
+        m_order.pop_front();
+    }
+}
+
+// What compiling one input printed, and how it ended
+struct input_result {
+    std::string out;
+    std::string err;
+    int status{0};
+    std::exception_ptr exception{};
+
+    [[nodiscard]] bool failed() const noexcept { return status || exception; }
+};
+
+// Runs one step for an input with its messages collected into `result`. Once a step has failed, the
+// input's remaining steps are skipped.
+static void run_captured(input_result &result, const std::function<void()> &step) {
+    if (result.failed())
+        return;
+    diagnostic_buffer buffer;
+    try {
+        step();
+    } catch (const compiler_exit &exit) {
+        result.status = exit.status;
+    } catch (...) {
+        result.exception = std::current_exception();
+    }
+    result.out += buffer.out();
+    result.err += buffer.err();
+}
+
+// Prints every input's messages in input order; the first failing input (in input order) decides
+// the exit status, so the result does not depend on which thread finished first
+static void report_results(const std::vector<const input_result *> &results) {
+    int status = 0;
+    for (auto result : results) {
+        std::cout << result->out << std::flush;
+        std::cerr << result->err << std::flush;
+        if (result->exception)
+            std::rethrow_exception(result->exception);
+        if (result->status && !status)
+            status = result->status;
+    }
+    if (status)
+        throw compiler_exit{status};
+}
+
+// One input on its way through the compile pipeline. Each stage consumes what the one before it
+// left, so a unit only holds on to the representation it is currently in.
+struct compile_unit {
+    std::size_t index;
+    std::string_view file;
+    input_result result{};
+    std::unique_ptr<llvm::MemoryBuffer> source{};
+    std::unique_ptr<llvm::MemoryBuffer> artifact{}; // a compilation cache hit, or bitcode given as input
+    std::string artifact_key{};
+    std::string program_key{};
+    lexed_file lexed{};
+    std::unique_ptr<file_node> parsed{};
+    std::shared_ptr<const program> analysed{};
+    const source_file *streamed{}; // -fstream-items leaves the front-end to run along with codegen
+
+    // Whether the front-end still has work to do for this unit
+    [[nodiscard]] bool needs_front_end() const noexcept { return !is_ir_file(file) && !artifact && !analysed && !streamed; }
+};
+
+// Runs one stage for `unit`, attributed to its file in the time trace and to `phase` in the stats
+static void run_stage(compile_unit &unit, const source_manager &sources, compile_stats *stats, compile_phase phase,
+        const std::function<void()> &step) {
+    llvm::TimeTraceScope trace{"Compile file", unit.file};
+    diagnostic_context context{unit.file, nullptr, &sources};
+    phase_allocations allocations{stats, phase};
+    run_captured(unit.result, step);
+}
+
+// What --dump-tokens, --dump-ast and --dump-hir ask to print as each file goes through the front-end
+struct dump_options {
+    bool tokens{false};
+    bool ast{false};
+    bool hir{false};
+};
+
+static void lex_unit(compile_unit &unit, source_manager &sources, const dump_options &dumps) {
+    // The source manager keeps the text, for diagnostics to find lines in
+    unit.lexed = lex(sources.add(std::string{unit.file}, std::move(unit.source)));
+
+    if (dumps.tokens) {
+        compiler_out() << "Tokens:" << std::endl;
+        for (const auto &token : unit.lexed.tokens) {
+            compiler_out() << "\t{" << presume(token.get_location())
+                << " " << std::quoted(token.get_text()) << "}" << std::endl;
+        }
+    }
+}
+
+static void parse_unit(compile_unit &unit, const dump_options &dumps) {
+    unit.parsed = std::make_unique<file_node>(parse_file(std::move(unit.lexed)));
+    unit.lexed = {};
+
+    if (dumps.ast)
+        compiler_out() << "AST: " << *unit.parsed << std::endl;
+}
+
+static void analyze_unit(compile_unit &unit, const symbol_table &imports, const std::vector<std::string> *roots,
+        const hir_pass_manager &hir_passes, compile_stats *stats, const dump_options &dumps) {
+    auto analysed = analyze(std::move(*unit.parsed), imports, roots);
+    hir_passes.run(analysed, stats);
+    unit.analysed = std::make_shared<const program>(std::move(analysed));
+    unit.parsed.reset();
+
+    if (dumps.hir)
+        compiler_out() << "Analysed: " << *unit.analysed << std::endl;
+}
+
+static std::unique_ptr<llvm::raw_fd_ostream> open_output(const std::string &path) {
+    std::error_code errorCode;
+    auto dest = std::make_unique<llvm::raw_fd_ostream>(path, errorCode);
+    if (errorCode) {
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to open output file: " + errorCode.message()});
+        throw compiler_exit{1};
+    }
+    return dest;
+}
+
+// Everything besides the source that decides what codegen produces for it. The target is keyed on
+// its spec, so that looking up a file doesn't wait for a TargetMachine.
+static std::string artifact_key(llvm::StringRef source, const std::string &front_end_key, const std::string &profile_key,
+        const target_spec &target, const codegen_options &options) {
+    return cache_key_builder{}
+        .add("source", source)
+        .add("front-end", front_end_key)
+        .add("profile", profile_key)
+        .add("triple", normalized_triple(target))
+        .add("cpu", target.cpu)
+        .add("features", target.features)
+        .add("opt-level", std::to_string(static_cast<int>(options.opt_level)))
+        .add("lto", std::to_string(static_cast<int>(options.lto)))
+        .add("emit", std::to_string(static_cast<int>(options.emit)))
+        .add("multiversion", llvm::join(options.multiversion, ","))
+        .finish();
+}
+
+// The same for one function's optimized bitcode under --cache-granularity=function, which doesn't
+// depend on what the whole file is emitted as. The fingerprint names imported callees, but only the
+// interfaces say what they take and return.
+static std::string function_key(const std::string &fingerprint, const std::string &imports_key, const std::string &profile_key,
+        const target_spec &target, const codegen_options &options) {
+    return cache_key_builder{}
+        .add("function", fingerprint)
+        .add("imports", imports_key)
+        .add("profile", profile_key)
+        .add("triple", normalized_triple(target))
+        .add("cpu", target.cpu)
+        .add("features", target.features)
+        .add("opt-level", std::to_string(static_cast<int>(options.opt_level)))
+        .add("lto", std::to_string(static_cast<int>(options.lto)))
+        .add("multiversion", llvm::join(options.multiversion, ","))
+        .finish();
+}
+
+// Instrumented code calls into compiler-rt's profile runtime, which Cannon builds for the host
+// only. Referencing __llvm_profile_runtime makes the linker keep the part that writes the profile
+// out at exit.
+static void add_profile_runtime(link_options &options) {
+    std::string_view runtime{CANNON_PROFILE_RUNTIME};
+    if (runtime.empty()) {
+        report({diagnostic_level::Error, {}, 0, 0, "This Cannon was built without the profile runtime (CANNON_BUILD_PROFILE_RUNTIME), so "
+            "-fprofile-generate can only be used with --compile-only"});
+        throw compiler_exit{1};
+    }
+    if (llvm::Triple{CANNON_PROFILE_RUNTIME_TRIPLE} != options.triple) {
+        report({diagnostic_level::Error, {}, 0, 0, std::string{"The profile runtime is only available for "} + CANNON_PROFILE_RUNTIME_TRIPLE
+            + ", not " + options.triple.str()});
+        throw compiler_exit{1};
+    }
+    options.runtime_libs.emplace_back(runtime);
+    options.undefined_symbols.emplace_back("__llvm_profile_runtime");
+}
+
+static std::optional<link_type> parse_link_type(std::string_view name) {
+    if (name == "exec"sv)
+        return link_type::Exec;
+    else if (name == "joined"sv)
+        return link_type::JoinedModule;
+    else if (name == "shared-module"sv)
+        return link_type::SharedModule;
+    else if (name == "staticlib"sv)
+        return link_type::StaticLib;
+    else if (name == "sharedlib"sv)
+        return link_type::SharedLib;
+    else if (name == "partial"sv)
+        return link_type::Partial;
+    return std::nullopt;
+}
+
+static std::string_view default_output_name(link_type type) {
+    switch (type) {
+      case link_type::StaticLib:
+      case link_type::JoinedModule:
+        return "liba.a"sv;
+      case link_type::SharedLib:
+      case link_type::SharedModule:
+        return "liba.so"sv;
+      default:
+        return "a.out"sv;
+    }
+}
+
+static int drive(const std::vector<std::string_view> &opts, const driver_environment &env) {
+    // CLI
+    std::string_view output{"a.o"};
+    bool explicit_output{false};
+    std::optional<std::string_view> output_dir{};
+    std::vector<std::string_view> input_files{};
+    std::vector<std::string_view> libs{};
+    std::vector<std::string_view> libdirs{};
+    auto mode{cannon::compiler_mode::CompileAndLink};
+    auto output_type{cannon::link_type::Exec};
+    optimization_level opt_level{0};
+    lto_mode lto{lto_mode::None};
+    std::optional<std::string> profile_generate{};
+    std::optional<std::string> profile_use{};
+    std::optional<std::string_view> cpu{};
+    std::vector<std::string_view> cpu_features{};
+    std::optional<std::string_view> multiversion{};
+    bool prune_unreachable{true};
+    std::optional<std::string_view> hir_passes_selection{};
+    bool stream_items{false};
+    unsigned stream_chunk{1024}; // functions of a streamed file compiled to one object
+    bool ir_text{false};
+    dump_options dumps{};
+    std::string_view cache_dir{};
+    std::string_view cache_size{"1g"};
+    bool function_granularity{false};
+    std::optional<std::string> server_socket{};
+    bool stop_server{false};
+    std::string_view thinlto_cache_dir{};
+    unsigned thinlto_jobs{0};
+    std::string_view linker{CANNON_DEFAULT_LINKER};
+    std::optional<std::string_view> sysroot{};
+    std::string_view target{CANNON_DEFAULT_TRIPLE};
+    std::optional<std::string_view> depfile{};
+    std::optional<std::string_view> depfile_target{};
+    std::optional<std::string_view> dep_graph{};
+    std::vector<std::string_view> import_paths{};
+    unsigned jobs{default_jobs()};
+    struct {
+        unsigned lex{1};
+        unsigned parse{1};
+        unsigned analyze{1};
+        unsigned emit{0}; // -j
+    } stage_threads;
+    std::size_t pipeline_depth{0};
+    std::optional<std::string> time_trace{};
+    unsigned time_trace_granularity{500};
+    bool stats_enabled{false};
+    bool stats_json{false};
+    std::optional<std::string_view> stats_path{};
+    for (auto it = std::next(begin(opts)); it != end(opts); it++) { // ADL too OP
+        auto opt{*it};
+        if (opt == "--target"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            target = *it;
+        } else if (opt.starts_with("--target="sv)) {
+            target = opt.substr(9);
+        } else if (opt=="--sysroot") {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            sysroot = *it;
+        } else if (opt.starts_with("--sysroot="sv)) {
+            sysroot = opt.substr(10);
+        } else if (opt.starts_with("-fuse-ld="sv)) {
+            linker = opt.substr(9);
+        } else if (opt == "--dump-tokens"sv) {
+            dumps.tokens = true;
+        } else if (opt == "--dump-ast"sv) {
+            dumps.ast = true;
+        } else if (opt == "--dump-hir"sv) {
+            dumps.hir = true;
+        } else if (opt == "--compile-only"sv) {
+            mode = compiler_mode::CompileOnly;
+        } else if (opt == "-ftype-check"sv || opt == "--check"sv) {
+            mode = compiler_mode::TypeCheck;
+        } else if (opt == "-O"sv || opt == "-O2"sv) {
+            opt_level = optimization_level{2};
+        } else if (opt == "-O0"sv) {
+            opt_level = optimization_level{};
+        } else if (opt == "-O1"sv) {
+            opt_level = optimization_level{1};
+        } else if (opt == "-O3"sv) {
+            opt_level = optimization_level{3};
+        } else if (opt == "-Og"sv) {
+            opt_level = optimization_level::Debug;
+        } else if (opt == "-Os"sv) {
+            opt_level = optimization_level::Size;
+        } else if (opt == "-Oz"sv) {
+            opt_level = optimization_level::Zize;
+        } else if (opt == "-Ofast"sv) {
+            opt_level = optimization_level::Fast;
+        } else if (opt == "-Oextra"sv) {
+            opt_level = optimization_level::Extra;
+        } else if (opt == "-flto=thin"sv) {
+            lto = lto_mode::Thin;
+        } else if (opt == "-fno-lto"sv) {
+            lto = lto_mode::None;
+        } else if (opt.starts_with("-flto"sv)) {
+            report({diagnostic_level::Error, {}, 0, 0, "Only -flto=thin is supported"});
+            throw compiler_exit{1};
+        } else if (opt.starts_with("-march="sv)) {
+            cpu = opt.substr(7);
+        } else if (opt.starts_with("-mcpu="sv)) {
+            cpu = opt.substr(6);
+        } else if (opt.starts_with("-mattr="sv)) {
+            cpu_features.push_back(opt.substr(7));
+        } else if (opt == "-fmultiversion"sv) {
+            multiversion = "x86-64-v3,x86-64-v4"sv;
+        } else if (opt.starts_with("-fmultiversion="sv)) {
+            multiversion = opt.substr(15);
+        } else if (opt == "-fno-multiversion"sv) {
+            multiversion.reset();
+        } else if (opt.starts_with("-fhir-passes="sv)) {
+            hir_passes_selection = opt.substr(13);
+        } else if (opt == "-fstream-items"sv) {
+            stream_items = true;
+        } else if (opt == "-fno-stream-items"sv) {
+            stream_items = false;
+        } else if (opt.starts_with("-fstream-chunk="sv)) {
+            stream_chunk = std::max(1u, parse_count("-fstream-chunk"sv, opt.substr(15)));
+        } else if (opt == "-fprune-unreachable"sv) {
+            prune_unreachable = true;
+        } else if (opt == "-fno-prune-unreachable"sv) {
+            prune_unreachable = false;
+        } else if (opt == "-fprofile-generate"sv) {
+            profile_generate = "";
+        } else if (opt.starts_with("-fprofile-generate="sv)) {
+            profile_generate = std::string{opt.substr(19)};
+        } else if (opt == "-fprofile-use"sv) {
+            profile_use = "default.profdata";
+        } else if (opt.starts_with("-fprofile-use="sv)) {
+            profile_use = std::string{opt.substr(14)};
+        } else if (opt.starts_with("--thinlto-cache-dir="sv)) {
+            thinlto_cache_dir = opt.substr(20);
+        } else if (opt.starts_with("--thinlto-jobs="sv)) {
+            thinlto_jobs = parse_count("--thinlto-jobs"sv, opt.substr(15));
+        } else if (opt.starts_with("--cache-dir="sv)) {
+            cache_dir = opt.substr(12);
+        } else if (opt.starts_with("--cache-size="sv)) {
+            cache_size = opt.substr(13);
+        } else if (opt == "--cache-granularity=file"sv) {
+            function_granularity = false;
+        } else if (opt == "--cache-granularity=function"sv) {
+            function_granularity = true;
+        } else if (opt == "-j"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            jobs = std::max(1u, parse_count("-j"sv, *it));
+        } else if (opt.starts_with("-j"sv)) {
+            jobs = std::max(1u, parse_count("-j"sv, opt.substr(2)));
+        } else if (opt == "-ftime-trace"sv) {
+            time_trace = "";
+        } else if (opt.starts_with("-ftime-trace="sv)) {
+            time_trace = std::string{opt.substr(13)};
+        } else if (opt.starts_with("-ftime-trace-granularity="sv)) {
+            time_trace_granularity = parse_count("-ftime-trace-granularity"sv, opt.substr(25));
+        } else if (opt == "-fstats"sv || opt == "-fstats=text"sv) {
+            stats_enabled = true;
+            stats_json = false;
+        } else if (opt == "-fstats=json"sv) {
+            stats_enabled = true;
+            stats_json = true;
+        } else if (opt.starts_with("-fstats-file="sv)) {
+            stats_path = opt.substr(13);
+        } else if (opt.starts_with("--lex-threads="sv)) {
+            stage_threads.lex = std::max(1u, parse_count("--lex-threads"sv, opt.substr(14)));
+        } else if (opt.starts_with("--parse-threads="sv)) {
+            stage_threads.parse = std::max(1u, parse_count("--parse-threads"sv, opt.substr(16)));
+        } else if (opt.starts_with("--analyze-threads="sv)) {
+            stage_threads.analyze = std::max(1u, parse_count("--analyze-threads"sv, opt.substr(18)));
+        } else if (opt.starts_with("--emit-threads="sv)) {
+            stage_threads.emit = std::max(1u, parse_count("--emit-threads"sv, opt.substr(15)));
+        } else if (opt.starts_with("--pipeline-depth="sv)) {
+            pipeline_depth = std::max<std::size_t>(1, parse_count("--pipeline-depth"sv, opt.substr(17)));
+        } else if (opt == "--deps"sv || opt == "-M"sv) {
+            mode = compiler_mode::Dependencies;
+        } else if (opt == "-MF"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            depfile = *it;
+        } else if (opt == "-MT"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            depfile_target = *it;
+        } else if (opt.starts_with("--dep-graph="sv)) {
+            dep_graph = opt.substr(12);
+        } else if (opt == "--module-server"sv) {
+            mode = compiler_mode::ModuleServer;
+        } else if (opt.starts_with("--module-server="sv)) {
+            mode = compiler_mode::ModuleServer;
+            server_socket = std::string{opt.substr(16)};
+        } else if (opt == "--use-server"sv) {
+            server_socket = default_server_socket();
+        } else if (opt.starts_with("--use-server="sv)) {
+            server_socket = std::string{opt.substr(13)};
+        } else if (opt == "--stop-server"sv) {
+            stop_server = true;
+        } else if (opt == "--generate-objects"sv) {
+            mode = compiler_mode::GenerateObjects;
+        } else if (opt.starts_with("--link-type="sv)) {
+            auto type = parse_link_type(opt.substr(12));
+            if (!type) {
+                report({diagnostic_level::Error, {}, 0, 0, "Unknown link type " + std::string{opt.substr(12)}});
+                throw compiler_exit{1};
+            }
+            output_type = *type;
+        } else if (opt == "-shared"sv) {
+            output_type = link_type::SharedLib;
+        } else if (opt == "-S"sv) {
+            mode = compiler_mode::CompileOnly;
+            ir_text = true;
+        } else if (opt == "-c"sv) {
+            mode = compiler_mode::CompileOnly;
+        } else if (opt == "-co"sv) {
+            mode = compiler_mode::CompileOnly;
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            output = *it;
+            explicit_output = true;
+        } else if (opt.starts_with("-co"sv)) {
+            mode = compiler_mode::CompileOnly;
+            output = opt.substr(3);
+            explicit_output = true;
+        } else if (opt=="-o"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            output = *it;
+            explicit_output = true;
+        } else if (opt.starts_with("-o"sv)) {
+            output = opt.substr(2);
+            explicit_output = true;
+        } else if (opt == "--out-dir"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            output_dir = *it;
+        } else if (opt.starts_with("--out-dir="sv)) {
+            output_dir = opt.substr(10);
+        } else if (opt == "--import"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            import_paths.push_back(*it);
+        } else if (opt.starts_with("--import="sv)) {
+            import_paths.push_back(opt.substr(9));
+        } else if (opt == "-l"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            libs.push_back(*it);
+        } else if (opt.starts_with("-l"sv)) {
+            libs.push_back(opt.substr(2));
+        } else if (opt == "-L"sv) {
+            it++;
+            if (it == end(opts))
+                throw compiler_exit{1};
+            libdirs.push_back(*it);
+        } else if (opt.starts_with("-L"sv)) {
+            libdirs.push_back(opt.substr(2));
+        } else {
+            input_files.push_back(opt);
+        }
+    }
+
+
+    if (mode == compiler_mode::ModuleServer) {
+        if (env.in_server) {
+            report({diagnostic_level::Error, {}, 0, 0, "Already running in a module server"});
+            return 1;
+        }
+        return run_module_server(server_socket.value_or(default_server_socket()), std::string{target});
+    }
+    if (server_socket && !env.in_server) {
+        // Everything but the server selection is forwarded, and the server runs it as if it were us
+        std::vector<std::string_view> forwarded;
+        for (auto opt : opts)
+            if (!opt.starts_with("--use-server"sv))
+                forwarded.push_back(opt);
+        if (auto status = forward_to_server(*server_socket, forwarded))
+            return *status;
+        if (stop_server) {
+            report({diagnostic_level::Error, {}, 0, 0, "No module server is listening on " + std::string{*server_socket}});
+            return 1;
+        }
+        // No server running; compile here instead
+    }
+
+    bool linking = mode == compiler_mode::CompileAndLink;
+    if (linking && !explicit_output)
+        output = default_output_name(output_type);
+
+    std::optional<compile_stats> stats{};
+    if (stats_enabled)
+        stats.emplace();
+    compile_stats *stats_ptr = stats ? &*stats : nullptr;
+
+    // Like clang, the trace is named after the output unless given a name
+    std::optional<time_trace_session> trace_session{};
+    if (time_trace)
+        trace_session.emplace(time_trace->empty() ? std::string{output} + ".json" : *time_trace, time_trace_granularity);
+
+    if (mode == compiler_mode::Dependencies) {
+        // Lexer and item pre-parse only; the graph goes to stdout unless asked for elsewhere
+        auto deps = scan_dependencies(std::vector<std::string>(input_files.begin(), input_files.end()), jobs);
+        if (depfile) {
+            std::ofstream out{std::string{*depfile}};
+            auto target_name = depfile_target ? *depfile_target : explicit_output ? output : default_output_name(output_type);
+            write_depfile(out, std::string{target_name}, deps);
+        }
+        if (dep_graph) {
+            std::ofstream out{std::string{*dep_graph}};
+            write_dependency_graph(out, deps);
+        } else if (!depfile) {
+            write_dependency_graph(std::cout, deps);
+        }
+        return 0;
+    }
+
+    bool batch = input_files.size() > 1;
+    // Like other compilers, -c without -o names the output after the input
+    bool derive_names = !linking && (batch || !explicit_output);
+    if (batch && explicit_output && !output_dir && !linking && mode < compiler_mode::TypeCheck) {
+        report({diagnostic_level::Error, {}, 0, 0, "Cannot write " + std::to_string(input_files.size()) + " input files to a single output \""
+            + std::string{output} + "\"; use --out-dir instead"});
+        throw compiler_exit{1};
+    }
+
+    // Type checking never touches LLVM. Otherwise its target setup, shared by every input, starts
+    // in the background and overlaps with the front-end; the first target_machine_lease waits for it.
+    bool generating_code = mode < compiler_mode::TypeCheck && !input_files.empty();
+    // -march=native asks for the machine we run on, so the cache keys get the CPU it resolves to;
+    // -mattr features come after the CPU's own, so that they can turn them off
+    target_spec spec{std::string{target}};
+    if (cpu == "native"sv) {
+        if (!is_host_target(target)) {
+            report({diagnostic_level::Error, {}, 0, 0, "-march=native cannot be used when compiling for " + std::string{target} + " on another machine"});
+            throw compiler_exit{1};
+        }
+        spec.cpu = host_cpu();
+        spec.features = host_features();
+    } else if (cpu) {
+        spec.cpu = std::string{*cpu};
+    }
+    for (auto features : cpu_features) {
+        if (!spec.features.empty())
+            spec.features += ',';
+        spec.features += features;
+    }
+    std::future<void> target_ready{};
+    if (generating_code) {
+        if (!target.empty() && !is_configured_target(target))
+            report({diagnostic_level::Warning, {}, 0, 0, std::string{target} + " is not one of the configured targets (" + CANNON_TARGET_TRIPLES
+                + "), so no standard library is available for it"});
+        target_ready = prepare_target(spec);
+        if (output_dir)
+            std::filesystem::create_directories(*output_dir);
+    }
+
+    // Module interfaces stand in for the sources of the modules this one depends on. They only
+    // change the output through what they declare, so they're keyed by their contents.
+    std::vector<module_interface> interfaces;
+    for (auto path : import_paths)
+        interfaces.push_back(module_interface::load(path));
+    symbol_table imports;
+    cache_key_builder imports_key_builder{};
+    for (const auto &interface : interfaces) {
+        imports.import(interface);
+        imports_key_builder.add("import", interface.contents());
+    }
+    std::string imports_key = interfaces.empty() ? std::string{} : imports_key_builder.finish();
+
+    // An executable only needs what main reaches. With several inputs, anything one of them calls
+    // in another is a root too, which the item pre-parse finds without building ASTs. Files the
+    // pre-parse can't read, and IR inputs, whose calls it can't see, leave every function in.
+    std::optional<std::vector<std::string>> roots{};
+    std::string roots_key{};
+    bool whole_program = linking && output_type == link_type::Exec && generating_code
+        && std::none_of(input_files.begin(), input_files.end(), is_ir_file);
+    if (prune_unreachable && whole_program) {
+        std::set<std::string> names{"main"};
+        if (input_files.size() > 1) {
+            try {
+                auto deps = scan_dependencies(std::vector<std::string>(input_files.begin(), input_files.end()), jobs, true);
+                for (const auto &file : deps)
+                    names.insert(file.references.begin(), file.references.end());
+            } catch (const compiler_exit &) {
+                names.clear();
+            }
+        }
+        if (!names.empty()) {
+            roots.emplace(names.begin(), names.end());
+            roots_key = cache_key_builder{}.add("roots", llvm::join(*roots, ",")).finish();
+        }
+    }
+
+    // The HIR passes shrink what LLVM gets to see, so they run whenever LLVM optimizes
+    hir_pass_manager hir_passes = opt_level == optimization_level{0} ? hir_pass_manager{} : default_hir_pipeline();
+    if (hir_passes_selection) {
+        auto selected = make_hir_pipeline(*hir_passes_selection);
+        if (!selected) {
+            report({diagnostic_level::Error, {}, 0, 0, "-fhir-passes takes a list of " + llvm::join(hir_pass_names(), ", ") + ", not "
+                + std::string{*hir_passes_selection}});
+            throw compiler_exit{1};
+        }
+        hir_passes = std::move(*selected);
+    }
+
+    // Everything besides the source that decides the analysed program, and how a streamed one is
+    // split up for codegen
+    std::string front_end_key = cache_key_builder{}
+        .add("imports", imports_key)
+        .add("roots", roots_key)
+        .add("hir-passes", hir_passes.description())
+        .add("stream-items", stream_items ? std::to_string(stream_chunk) : "no")
+        .finish();
+
+    // Modules get a .tbd interface next to each object, and one for the whole module when linking
+    bool write_interfaces = output_type == link_type::JoinedModule || output_type == link_type::SharedModule;
+    if (stream_items && write_interfaces) {
+        report({diagnostic_level::Error, {}, 0, 0, "-fstream-items cannot write module interfaces, which need every function of a file at once"});
+        throw compiler_exit{1};
+    }
+    std::vector<std::shared_ptr<const program>> module_programs(write_interfaces && linking ? input_files.size() : 0);
+
+    codegen_options options{opt_level, lto};
+    if (mode == compiler_mode::CompileOnly)
+        options.emit = ir_text ? emit_kind::IRText : emit_kind::Bitcode;
+    options.stats = stats_ptr;
+
+    if (multiversion && generating_code) {
+        auto cpus = parse_multiversion_cpus(*multiversion);
+        if (!cpus) {
+            report({diagnostic_level::Error, {}, 0, 0, "-fmultiversion takes a list of x86-64-v2, x86-64-v3 and x86-64-v4, not " + std::string{*multiversion}});
+            throw compiler_exit{1};
+        }
+        if (auto why = multiversion_unsupported(llvm::Triple{llvm::Triple::normalize(target)}); !why.empty()) {
+            report({diagnostic_level::Error, {}, 0, 0, why});
+            throw compiler_exit{1};
+        }
+        if (opt_level == optimization_level{0} || lto == lto_mode::Thin)
+            report({diagnostic_level::Warning, {}, 0, 0, "-fmultiversion has no effect at -O0 or with -flto=thin"});
+        options.multiversion = std::move(*cpus);
+    }
+
+    // Like clang, -fprofile-generate=<dir> names a directory for the raw profiles, and %m keeps
+    // the profiles of different programs apart. The profile used goes into the cache keys by its
+    // contents, so a fresh profile never picks up stale artifacts.
+    if (profile_generate && profile_use) {
+        report({diagnostic_level::Error, {}, 0, 0, "-fprofile-generate and -fprofile-use cannot be used together"});
+        throw compiler_exit{1};
+    }
+    std::string profile_key{};
+    if (profile_generate) {
+        llvm::SmallString<128> path{*profile_generate};
+        llvm::sys::path::append(path, "default_%m.profraw");
+        options.profile_generate = std::string{path};
+        profile_key = cache_key_builder{}.add("generate", options.profile_generate).finish();
+    } else if (profile_use && generating_code) {
+        auto profile = llvm::MemoryBuffer::getFile(*profile_use);
+        if (!profile) {
+            report({diagnostic_level::Error, {}, 0, 0, "Failed to read profile " + *profile_use + ": " + profile.getError().message()
+                + " (create it from .profraw files with llvm-profdata merge)"});
+            throw compiler_exit{1};
+        }
+        options.profile_use = *profile_use;
+        profile_key = cache_key_builder{}.add("use", (*profile)->getBuffer()).finish();
+    }
+    auto extension = options.emit == emit_kind::Object ? ".o"sv : options.emit == emit_kind::Bitcode ? ".bc"sv : ".ll"sv;
+    // Outputs are named after their inputs' stems alone, so inputs from different directories, or
+    // with different extensions, can land on the same file
+    if (generating_code && derive_names) {
+        std::map<std::string, std::string_view> written_by;
+        for (auto input : input_files) {
+            auto path = output_path_for(input, output, output_dir, derive_names, extension);
+            if (auto [it, added] = written_by.emplace(path, input); !added) {
+                report({diagnostic_level::Error, {}, 0, 0, std::string{it->second} + " and " + std::string{input}
+                    + " would both be written to " + path + "; compile them separately, with different --out-dir"});
+                throw compiler_exit{1};
+            }
+        }
+    }
+
+    // When linking, objects stay in memory until the link step, in input order; otherwise each is
+    // written out
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects(linking ? input_files.size() : 0);
+    auto emit_output = [&](std::size_t i, auto &&write) {
+        auto input = input_files[i];
+        if (linking) {
+            llvm::SmallVector<char, 0> buffer;
+            llvm::raw_svector_ostream stream{buffer};
+            write(stream);
+            auto name = std::filesystem::path{input}.stem().string() + ".o";
+            objects[i] = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef{buffer.data(), buffer.size()}, name);
+        } else {
+            auto dest = open_output(output_path_for(input, output, output_dir, derive_names, extension));
+            write(*dest);
+        }
+    };
+
+    // ThinLTO keeps its own cache (--thinlto-cache-dir), since its results depend on every module.
+    // Interfaces are written from the analysed program, which a cache hit never has.
+    std::optional<compilation_cache> cache{};
+    if (!cache_dir.empty() && mode < compiler_mode::TypeCheck && lto == lto_mode::None && !write_interfaces)
+        cache.emplace(std::string{cache_dir}, cache_size);
+
+    // Under ThinLTO, sources are compiled to summarized bitcode in memory for the ThinLTO link, and
+    // bitcode from earlier --compile-only runs is used as-is
+    bool thin_link = lto == lto_mode::Thin && mode < compiler_mode::CompileOnly;
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> bitcode(thin_link ? input_files.size() : 0);
+
+    source_manager sources;
+    std::vector<compile_unit> units;
+    for (std::size_t i = 0; i < input_files.size(); i++)
+        units.push_back(compile_unit{i, input_files[i]});
+
+    // The stages overlap across inputs: while the backend works on one file, the front-end is
+    // already on the next ones. The front-end is cheap next to LLVM, so it gets one thread per stage
+    // by default and the backend gets the rest.
+    std::vector<pipeline_stage<compile_unit>> stages{
+        {"lex", stage_threads.lex, [&](compile_unit &unit) { run_stage(unit, sources, stats_ptr, compile_phase::Lex, [&] {
+            if (is_ir_file(unit.file)) {
+                if (mode >= compiler_mode::CompileOnly) {
+                    report({diagnostic_level::Error, {}, 0, 0, "Already compiled to IR"});
+                    throw compiler_exit{1};
+                }
+                if (thin_link && !unit.file.ends_with(".bc"sv)) {
+                    report({diagnostic_level::Error, {}, 0, 0, "ThinLTO takes bitcode, not textual IR"});
+                    throw compiler_exit{1};
+                }
+                return;
+            }
+            unit.source = read_source(unit.file);
+            if (cache) {
+                // A hit skips the whole pipeline, front-end included
+                unit.artifact_key = artifact_key(unit.source->getBuffer(), front_end_key, profile_key, spec, options);
+                if ((unit.artifact = cache->lookup(unit.artifact_key)))
+                    return;
+            }
+            if (stream_items) {
+                unit.streamed = &sources.add(std::string{unit.file}, std::move(unit.source));
+                return;
+            }
+            if (env.programs) {
+                unit.program_key = cache_key_builder{}.add("source", unit.source->getBuffer()).add("front-end", front_end_key).finish();
+                if ((unit.analysed = env.programs->lookup(unit.program_key)))
+                    return;
+            }
+            lex_unit(unit, sources, dumps);
+            if (stats_ptr) {
+                stats_ptr->add_file();
+                stats_ptr->add_tokens(unit.lexed.tokens);
+            }
+        }); }},
+        {"parse", stage_threads.parse, [&](compile_unit &unit) { run_stage(unit, sources, stats_ptr, compile_phase::Parse, [&] {
+            if (!unit.needs_front_end())
+                return;
+            parse_unit(unit, dumps);
+            if (stats_ptr)
+                stats_ptr->add_ast(*unit.parsed);
+        }); }},
+        {"analyze", stage_threads.analyze, [&](compile_unit &unit) { run_stage(unit, sources, stats_ptr, compile_phase::Analyze, [&] {
+            if (unit.streamed && mode >= compiler_mode::TypeCheck) {
+                // Without codegen, nothing waits for the functions
+                analyze_streaming(*unit.streamed, imports, hir_passes, stats_ptr, [](const function &) {});
+                return;
+            }
+            if (!unit.needs_front_end())
+                return;
+            analyze_unit(unit, imports, roots ? &*roots : nullptr, hir_passes, stats_ptr, dumps);
+            if (stats_ptr)
+                stats_ptr->add_hir(*unit.analysed);
+            if (env.programs)
+                env.programs->insert(unit.program_key, unit.analysed);
+        }); }},
+        {"emit", stage_threads.emit ? stage_threads.emit : jobs, [&](compile_unit &unit) { run_stage(unit, sources, stats_ptr, compile_phase::Codegen, [&] {
+            target_machine_lease lease{spec};
+            auto &thread_target = *lease;
+            // A streamed file's functions go into its module as soon as each is analysed
+            auto build = [&](llvm::LLVMContext &context) {
+                if (!unit.streamed)
+                    return build_module(*unit.analysed, context, thread_target);
+                auto module = create_module(context, thread_target);
+                analyze_streaming(*unit.streamed, imports, hir_passes, stats_ptr, [&](const function &fn) { add_function(*module, fn); });
+                return module;
+            };
+            // A streamed file's object is compiled a chunk of functions at a time, so that LLVM
+            // only ever holds one chunk, and the chunks' objects are joined at the end. Its IR
+            // and bitcode can only be written whole.
+            auto generate_chunks = [&](llvm::raw_pwrite_stream &out) {
+                std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+                std::unique_ptr<llvm::LLVMContext> context;
+                std::unique_ptr<llvm::Module> module;
+                unsigned functions = 0;
+                auto start = [&] {
+                    context = std::make_unique<llvm::LLVMContext>();
+                    module = create_module(*context, thread_target);
+                };
+                auto finish = [&] {
+                    llvm::SmallVector<char, 0> object;
+                    llvm::raw_svector_ostream stream{object};
+                    codegen_module(*module, stream, thread_target, options);
+                    objects.push_back(llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef{object.data(), object.size()}, unit.file));
+                    module.reset();
+                    context.reset();
+                    functions = 0;
+                };
+                analyze_streaming(*unit.streamed, imports, hir_passes, stats_ptr, [&](const function &fn) {
+                    if (!module)
+                        start();
+                    add_function(*module, fn);
+                    if (++functions == stream_chunk)
+                        finish();
+                });
+                // A file without functions still gets an object
+                if (!module && objects.empty())
+                    start();
+                if (module)
+                    finish();
+                link_options join_options{};
+                join_options.triple = thread_target.getTargetTriple();
+                join_options.linker = std::string{linker};
+                if (sysroot)
+                    join_options.sysroot = std::string{*sysroot};
+                out << join_objects(objects, join_options)->getBuffer();
+            };
+            auto generate = [&](llvm::raw_pwrite_stream &out) {
+                if (unit.streamed && options.emit == emit_kind::Object)
+                    return generate_chunks(out);
+                llvm::LLVMContext context;
+                auto module = build(context);
+                codegen_module(*module, out, thread_target, options);
+            };
+            if (thin_link) {
+                if (is_ir_file(unit.file)) {
+                    bitcode[unit.index] = read_ir(unit.file);
+                    return;
+                }
+                llvm::LLVMContext context;
+                auto module = build(context);
+                optimize_module(*module, thread_target, options);
+                if (stats_ptr)
+                    stats_ptr->add_llvm_instructions(module->getInstructionCount());
+                llvm::SmallVector<char, 0> buffer;
+                llvm::raw_svector_ostream stream{buffer};
+                emit_bitcode(*module, options, stream);
+                bitcode[unit.index] = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef{buffer.data(), buffer.size()}, unit.file);
+            } else if (is_ir_file(unit.file)) {
+                auto ir = read_ir(unit.file);
+                emit_output(unit.index, [&](llvm::raw_pwrite_stream &out) { codegen_ir(ir->getMemBufferRef(), out, thread_target, options); });
+            } else if (unit.artifact) {
+                emit_output(unit.index, [&](llvm::raw_pwrite_stream &out) { out << unit.artifact->getBuffer(); });
+            } else if (!cache) {
+                emit_output(unit.index, generate);
+            } else {
+                llvm::SmallVector<char, 0> artifact;
+                llvm::raw_svector_ostream stream{artifact};
+                if (function_granularity && !unit.streamed) {
+                    // The file changed, but most of its functions probably didn't
+                    function_cache functions{
+                        [&](const std::string &fingerprint) { return cache->lookup(function_key(fingerprint, imports_key, profile_key, spec, options)); },
+                        [&](const std::string &fingerprint, llvm::StringRef bitcode) {
+                            cache->insert(function_key(fingerprint, imports_key, profile_key, spec, options), bitcode);
+                        },
+                    };
+                    codegen_incremental(*unit.analysed, stream, thread_target, options, functions);
+                } else {
+                    generate(stream);
+                }
+                llvm::StringRef contents{artifact.data(), artifact.size()};
+                cache->insert(unit.artifact_key, contents);
+                emit_output(unit.index, [&](llvm::raw_pwrite_stream &out) { out << contents; });
+            }
+            if (write_interfaces && unit.analysed) {
+                if (linking)
+                    module_programs[unit.index] = unit.analysed;
+                else
+                    write_interface(output_path_for(unit.file, output, output_dir, derive_names, extension), {unit.analysed.get()});
+            }
+            unit.analysed.reset();
+        }); }},
+    };
+    // Without codegen there is nothing for the backend threads to do
+    if (mode >= compiler_mode::TypeCheck)
+        stages.pop_back();
+    run_pipeline(units, stages, pipeline_depth ? pipeline_depth : stages.back().threads);
+
+    std::vector<const input_result *> results;
+    for (auto &unit : units)
+        results.push_back(&unit.result);
+    report_results(results);
+    if (cache)
+        cache->prune();
+
+    std::optional<target_machine_lease> lease;
+    if (generating_code)
+        lease.emplace(spec);
+    llvm::TargetMachine *target_machine = lease ? &**lease : nullptr;
+
+    if (thin_link) {
+        // Which input each module, and so each object, belongs to
+        std::vector<llvm::MemoryBufferRef> modules;
+        std::vector<std::size_t> module_inputs;
+        for (std::size_t i = 0; i < bitcode.size(); i++) {
+            if (!bitcode[i])
+                continue;
+            modules.push_back(bitcode[i]->getMemBufferRef());
+            module_inputs.push_back(i);
+        }
+        thin_lto_options link_options{options, thinlto_jobs ? thinlto_jobs : jobs, std::string{thinlto_cache_dir}, output_type != link_type::Exec};
+        auto lto_objects = [&] {
+            phase_allocations allocations{stats_ptr, compile_phase::Link};
+            return thin_lto_link(modules, *target_machine, link_options);
+        }();
+        for (std::size_t i = 0; i < lto_objects.size(); i++)
+            emit_output(module_inputs[i], [&](llvm::raw_pwrite_stream &out) { out << lto_objects[i]->getBuffer(); });
+    }
+
+    if (linking && !objects.empty()) {
+        link_options link_opts{output_type, std::string{output}, target_machine->getTargetTriple()};
+        link_opts.libs.assign(libs.begin(), libs.end());
+        link_opts.libdirs.assign(libdirs.begin(), libdirs.end());
+        if (sysroot)
+            link_opts.sysroot = std::string{*sysroot};
+        link_opts.linker = std::string{linker};
+        if (profile_generate && output_type != link_type::StaticLib && output_type != link_type::JoinedModule)
+            add_profile_runtime(link_opts);
+        phase_allocations allocations{stats_ptr, compile_phase::Link};
+        link(objects, link_opts);
+    }
+
+    if (write_interfaces && linking) {
+        std::vector<const program*> programs;
+        for (const auto &p : module_programs)
+            if (p)
+                programs.push_back(p.get());
+        write_interface(std::string{output}, programs);
+    }
+
+    if (stats) {
+        std::ofstream stats_file{};
+        if (stats_path)
+            stats_file.open(std::string{*stats_path});
+        std::ostream &out = stats_path ? stats_file : std::cerr;
+        if (stats_json)
+            stats->print_json(out);
+        else
+            stats->print(out);
+    }
+
+    return 0;
+}
+
+int cannon::run_driver(const std::vector<std::string_view> &args, const driver_environment &env) {
+    try {
+        return drive(args, env);
+    } catch (const compiler_exit &exit) {
+        return exit.status;
+    }
+}
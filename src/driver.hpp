@@ -0,0 +1,43 @@
+#ifndef CANNON_DRIVER_HPP
+#define CANNON_DRIVER_HPP
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "program.hpp"
+
+namespace cannon {
+
+// Analysed programs kept by a long-lived compiler process, keyed by a hash of their source, so that
+// unchanged files skip the front-end entirely. The oldest entries are dropped past `capacity`.
+// Safe to use from several threads.
+class program_cache {
+  private:
+    mutable std::mutex m_mutex;
+    std::size_t m_capacity;
+    std::list<std::string> m_order;
+    std::map<std::string, std::shared_ptr<const program>> m_programs;
+  public:
+    explicit program_cache(std::size_t capacity);
+    std::shared_ptr<const program> lookup(const std::string &key) const;
+    void insert(const std::string &key, std::shared_ptr<const program> p);
+};
+
+struct driver_environment {
+    program_cache *programs{nullptr};
+    bool in_server{false}; // running a request on behalf of a module server client
+};
+
+// Runs one compiler invocation. `args` is laid out like argv, starting with the program name.
+// Returns the exit status instead of exiting, even when compilation fails.
+int run_driver(const std::vector<std::string_view> &args, const driver_environment &env = {});
+
+}
+
+#endif // CANNON_DRIVER_HPP
@@ -0,0 +1,15 @@
+#ifndef CANNON_ERROR_HPP
+#define CANNON_ERROR_HPP
+
+namespace cannon {
+
+// Thrown where a fatal error would otherwise call std::exit, so that a long-lived compiler process
+// (the module server) outlives the compilations that fail in it. run_driver turns it back into an
+// exit status.
+struct compiler_exit {
+    int status;
+};
+
+}
+
+#endif // CANNON_ERROR_HPP
@@ -0,0 +1,447 @@
+#include "hir_passes.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/TimeProfiler.h>
+
+#include "stats.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+// Functions the program defines, by the name calls use for them
+using local_functions = std::unordered_map<std::string_view, std::uint32_t>;
+// Which node of a rebuilt tree stands for each node of the old one
+using copy_map = std::unordered_map<const expression*, const expression*>;
+// Stands in for a node and everything below it, or returns null to have the node copied
+using substitution = std::function<std::unique_ptr<expression>(const expression &, copy_map &)>;
+
+// The largest callee, in HIR nodes, that gets inlined
+static constexpr std::size_t inline_threshold = 16;
+
+static local_functions index_functions(const program &p) {
+    local_functions result;
+    for (std::uint32_t i = 0; i < p.functions().size(); i++)
+        result.emplace(p.functions()[i]->name(), i);
+    return result;
+}
+
+static const expression *value_of(const function &fn) {
+    // Codegen returns the first statement's value
+    return fn.statements().empty() ? nullptr : dynamic_cast<const expression*>(fn.statements().front().get());
+}
+
+// The function of this program that `call` calls, if there is one. Imported functions have a symbol.
+static std::optional<std::uint32_t> local_callee(const function_call_expression &call, const local_functions &locals) {
+    auto id_expr = dynamic_cast<const identifier_expression*>(&call.func());
+    if (!id_expr || !id_expr->symbol().empty())
+        return std::nullopt;
+    if (auto it = locals.find(id_expr->value()); it != locals.end())
+        return it->second;
+    return std::nullopt;
+}
+
+template <typename F>
+static void for_each_node(const expression &expr, F &&visit) {
+    visit(expr);
+    if (auto bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
+        for_each_node(bin_expr->lhs(), visit);
+        for_each_node(bin_expr->rhs(), visit);
+    } else if (auto fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
+        for_each_node(fn_expr->func(), visit);
+        for (const auto &param : fn_expr->params())
+            for_each_node(*param, visit);
+    }
+}
+
+template <typename F>
+static void for_each_node(const function &fn, F &&visit) {
+    for (const auto &statement : fn.statements())
+        if (auto expr = dynamic_cast<const expression*>(statement.get()))
+            for_each_node(*expr, visit);
+}
+
+static call_graph build_call_graph(const program &p) {
+    auto locals = index_functions(p);
+    call_graph result{p.functions().size()};
+    for (std::uint32_t i = 0; i < p.functions().size(); i++) {
+        for_each_node(*p.functions()[i], [&](const expression &expr) {
+            if (auto call = dynamic_cast<const function_call_expression*>(&expr))
+                if (auto callee = local_callee(*call, locals))
+                    result.add_call(i, *callee);
+        });
+    }
+    return result;
+}
+
+// Functions without side effects: those that only call others like them. Imported and external
+// functions could do anything.
+static std::vector<bool> pure_functions(const program &p, const local_functions &locals) {
+    std::vector<bool> pure(p.functions().size(), true);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::size_t i = 0; i < pure.size(); i++) {
+            if (!pure[i])
+                continue;
+            for_each_node(*p.functions()[i], [&](const expression &expr) {
+                auto call = dynamic_cast<const function_call_expression*>(&expr);
+                if (!call || !pure[i])
+                    return;
+                auto callee = local_callee(*call, locals);
+                if (!callee || !pure[*callee]) {
+                    pure[i] = false;
+                    changed = true;
+                }
+            });
+        }
+    }
+    return pure;
+}
+
+static bool is_pure(const expression &expr, const std::vector<bool> &pure, const local_functions &locals) {
+    bool result = true;
+    for_each_node(expr, [&](const expression &node) {
+        if (auto call = dynamic_cast<const function_call_expression*>(&node)) {
+            auto callee = local_callee(*call, locals);
+            result = result && callee && pure[*callee];
+        }
+    });
+    return result;
+}
+
+static std::size_t node_count(const expression &expr) {
+    std::size_t result = 0;
+    for_each_node(expr, [&](const expression &) { result++; });
+    return result;
+}
+
+// Copies `expr`, with whatever `substitute` returns in place of the nodes it wants to replace.
+// Reuses are pointed at the copies of their originals, which come before them.
+static std::unique_ptr<expression> rebuild(const expression &expr, const substitution &substitute, copy_map &copies) {
+    std::unique_ptr<expression> result;
+    if (substitute)
+        result = substitute(expr, copies);
+    if (result) {
+        // A replacement has the same value, so reuses of the old node can use it
+    } else if (auto bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
+        auto lhs = rebuild(bin_expr->lhs(), substitute, copies);
+        auto rhs = rebuild(bin_expr->rhs(), substitute, copies);
+        result = std::make_unique<binary_expression>(std::move(lhs), bin_expr->op(), std::move(rhs), bin_expr->return_type());
+    } else if (auto int_expr = dynamic_cast<const integer_expression*>(&expr)) {
+        result = std::make_unique<integer_expression>(int_expr->value());
+    } else if (auto id_expr = dynamic_cast<const identifier_expression*>(&expr)) {
+        result = std::make_unique<identifier_expression>(id_expr->id(), id_expr->symbol());
+    } else if (auto fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
+        auto func = rebuild(fn_expr->func(), substitute, copies);
+        std::vector<std::unique_ptr<expression>> params;
+        for (const auto &param : fn_expr->params())
+            params.push_back(rebuild(*param, substitute, copies));
+        result = std::make_unique<function_call_expression>(std::move(func), std::move(params));
+    } else if (auto reuse_expr = dynamic_cast<const reuse_expression*>(&expr)) {
+        result = std::make_unique<reuse_expression>(*copies.at(&reuse_expr->original()));
+    }
+    copies[&expr] = result.get();
+    return result;
+}
+
+// Rebuilds every statement of `fn`
+static void rebuild(function &fn, const substitution &substitute) {
+    copy_map copies;
+    std::vector<std::unique_ptr<statement>> statements;
+    for (const auto &statement : fn.statements())
+        statements.push_back(rebuild(dynamic_cast<const expression&>(*statement), substitute, copies));
+    fn.set_statements(std::move(statements));
+}
+
+// Replaces calls to small functions that can't reach themselves with a copy of their body. Callees
+// are done before their callers, so a body is copied with its own calls already inlined.
+class inline_pass : public hir_pass {
+  public:
+    std::string_view name() const noexcept override { return "inline"sv; }
+
+    std::uint64_t run(program &p) const override {
+        auto locals = index_functions(p);
+        auto recursive = p.calls().recursive();
+        std::uint64_t inlined = 0;
+        for (auto i : p.calls().bottom_up_order()) {
+            auto &fn = *p.functions()[i];
+            bool has_candidates = false;
+            for (auto callee : p.calls().callees(i))
+                has_candidates = has_candidates || !recursive[callee];
+            if (!has_candidates)
+                continue;
+            rebuild(fn, [&](const expression &expr, copy_map &) -> std::unique_ptr<expression> {
+                auto call = dynamic_cast<const function_call_expression*>(&expr);
+                if (!call || !call->params().empty())
+                    return nullptr;
+                auto callee = local_callee(*call, locals);
+                if (!callee || recursive[*callee] || p.functions()[*callee]->statements().size() != 1)
+                    return nullptr;
+                auto body = value_of(*p.functions()[*callee]);
+                if (!body || node_count(*body) > inline_threshold)
+                    return nullptr;
+                inlined++;
+                copy_map callee_copies;
+                return rebuild(*body, nullptr, callee_copies);
+            });
+        }
+        return inlined;
+    }
+};
+
+// Numbers expressions so that two get the same number exactly when they compute the same value
+// the same way, and notes which have no side effects
+class value_numbering {
+  private:
+    std::map<std::tuple<int, std::int64_t, std::uint32_t, std::uint32_t>, std::uint32_t> m_numbers;
+    std::map<std::pair<name_id, std::string>, std::uint32_t> m_names;
+    std::unordered_map<const expression*, std::pair<std::uint32_t, bool>> m_values;
+    const std::vector<bool> &m_pure;
+    const local_functions &m_locals;
+
+    std::uint32_t intern(std::tuple<int, std::int64_t, std::uint32_t, std::uint32_t> key) {
+        return m_numbers.emplace(key, static_cast<std::uint32_t>(m_numbers.size())).first->second;
+    }
+  public:
+    value_numbering(const std::vector<bool> &pure, const local_functions &locals) : m_pure(pure), m_locals(locals) {}
+
+    std::pair<std::uint32_t, bool> number(const expression &expr) {
+        std::pair<std::uint32_t, bool> result;
+        if (auto bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
+            auto lhs = number(bin_expr->lhs()), rhs = number(bin_expr->rhs());
+            result = {intern({1, bin_expr->op(), lhs.first, rhs.first}), lhs.second && rhs.second};
+        } else if (auto int_expr = dynamic_cast<const integer_expression*>(&expr)) {
+            result = {intern({2, int_expr->value(), 0, 0}), true};
+        } else if (auto id_expr = dynamic_cast<const identifier_expression*>(&expr)) {
+            auto name = m_names.emplace(std::pair{id_expr->id(), id_expr->symbol()}, static_cast<std::uint32_t>(m_names.size()));
+            result = {intern({3, name.first->second, 0, 0}), true};
+        } else if (auto fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
+            auto func = number(fn_expr->func());
+            auto callee = local_callee(*fn_expr, m_locals);
+            bool pure = callee && m_pure[*callee];
+            std::uint32_t params = 0;
+            for (const auto &param : fn_expr->params()) {
+                auto value = number(*param);
+                params = intern({4, 0, params, value.first});
+                pure = pure && value.second;
+            }
+            result = {intern({5, 0, func.first, params}), pure};
+        } else if (auto reuse_expr = dynamic_cast<const reuse_expression*>(&expr)) {
+            result = m_values.at(&reuse_expr->original());
+        } else {
+            // Nothing else is known to be comparable
+            result = {intern({0, static_cast<std::int64_t>(m_numbers.size()), 0, 0}), false};
+        }
+        m_values[&expr] = result;
+        return result;
+    }
+
+    std::pair<std::uint32_t, bool> operator[](const expression &expr) const {
+        return m_values.at(&expr);
+    }
+};
+
+// Replaces repeats of an operation or call without side effects with a reuse of the first one.
+// Evaluation is left to right, depth first, so the first one always has its value by then.
+class cse_pass : public hir_pass {
+  private:
+    struct function_state {
+        const value_numbering &numbers;
+        std::unordered_map<std::uint32_t, const expression*> seen;
+        copy_map copies;
+        std::uint64_t replaced{0};
+    };
+
+    static std::unique_ptr<expression> eliminate(const expression &expr, function_state &state) {
+        auto [number, pure] = state.numbers[expr];
+        bool candidate = pure && (dynamic_cast<const binary_expression*>(&expr) || dynamic_cast<const function_call_expression*>(&expr));
+        if (candidate) {
+            if (auto it = state.seen.find(number); it != state.seen.end()) {
+                state.replaced++;
+                state.copies[&expr] = it->second;
+                return std::make_unique<reuse_expression>(*it->second);
+            }
+        }
+        std::unique_ptr<expression> result;
+        if (auto bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
+            auto lhs = eliminate(bin_expr->lhs(), state);
+            auto rhs = eliminate(bin_expr->rhs(), state);
+            result = std::make_unique<binary_expression>(std::move(lhs), bin_expr->op(), std::move(rhs), bin_expr->return_type());
+        } else if (auto fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
+            auto func = eliminate(fn_expr->func(), state);
+            std::vector<std::unique_ptr<expression>> params;
+            for (const auto &param : fn_expr->params())
+                params.push_back(eliminate(*param, state));
+            result = std::make_unique<function_call_expression>(std::move(func), std::move(params));
+        } else {
+            result = rebuild(expr, nullptr, state.copies);
+        }
+        state.copies[&expr] = result.get();
+        if (candidate)
+            state.seen.emplace(number, result.get());
+        return result;
+    }
+  public:
+    std::string_view name() const noexcept override { return "cse"sv; }
+
+    std::uint64_t run(program &p) const override {
+        auto locals = index_functions(p);
+        auto pure = pure_functions(p, locals);
+        std::uint64_t replaced = 0;
+        for (const auto &fn : p.functions()) {
+            value_numbering numbers{pure, locals};
+            for (const auto &statement : fn->statements())
+                numbers.number(dynamic_cast<const expression&>(*statement));
+            function_state state{numbers};
+            std::vector<std::unique_ptr<statement>> statements;
+            for (const auto &statement : fn->statements())
+                statements.push_back(eliminate(dynamic_cast<const expression&>(*statement), state));
+            if (state.replaced) {
+                fn->set_statements(std::move(statements));
+                replaced += state.replaced;
+            }
+        }
+        return replaced;
+    }
+};
+
+// Removes expressions whose values nothing uses and that have no side effects: statements after
+// the one that gives the function its value, and operands multiplied by zero. Expressions a
+// reuse refers to stay.
+class dce_pass : public hir_pass {
+  public:
+    std::string_view name() const noexcept override { return "dce"sv; }
+
+    std::uint64_t run(program &p) const override {
+        auto locals = index_functions(p);
+        auto pure = pure_functions(p, locals);
+        std::uint64_t removed = 0;
+        for (const auto &fn : p.functions()) {
+            std::unordered_set<const expression*> reused;
+            for_each_node(*fn, [&](const expression &expr) {
+                if (auto reuse_expr = dynamic_cast<const reuse_expression*>(&expr))
+                    reused.insert(&reuse_expr->original());
+            });
+            auto removable = [&](const expression &expr) {
+                bool result = is_pure(expr, pure, locals);
+                for_each_node(expr, [&](const expression &node) { result = result && !reused.contains(&node); });
+                return result;
+            };
+
+            std::uint64_t removed_here = 0;
+            copy_map copies;
+            std::vector<std::unique_ptr<statement>> statements;
+            for (std::size_t i = 0; i < fn->statements().size(); i++) {
+                auto &expr = dynamic_cast<const expression&>(*fn->statements()[i]);
+                if (i > 0 && removable(expr)) {
+                    removed_here++;
+                    continue;
+                }
+                statements.push_back(rebuild(expr, [&](const expression &node, copy_map &) -> std::unique_ptr<expression> {
+                    auto bin_expr = dynamic_cast<const binary_expression*>(&node);
+                    if (!bin_expr || bin_expr->op() != MUL)
+                        return nullptr;
+                    auto is_zero = [](const expression &operand) {
+                        auto int_expr = dynamic_cast<const integer_expression*>(&operand);
+                        return int_expr && int_expr->value() == 0;
+                    };
+                    if (!(is_zero(bin_expr->lhs()) || is_zero(bin_expr->rhs())) || !removable(node))
+                        return nullptr;
+                    removed_here++;
+                    return std::make_unique<integer_expression>(0);
+                }, copies));
+            }
+            if (removed_here) {
+                fn->set_statements(std::move(statements));
+                removed += removed_here;
+            }
+        }
+        return removed;
+    }
+};
+
+void hir_pass_manager::add(std::shared_ptr<const hir_pass> pass) {
+    m_passes.push_back(std::move(pass));
+}
+
+bool hir_pass_manager::empty() const noexcept {
+    return m_passes.empty();
+}
+
+std::string hir_pass_manager::description() const {
+    std::string result;
+    for (const auto &pass : m_passes) {
+        if (!result.empty())
+            result += ',';
+        result += pass->name();
+    }
+    return result;
+}
+
+void hir_pass_manager::run(program &p, compile_stats *stats) const {
+    for (const auto &pass : m_passes) {
+        llvm::TimeTraceScope trace{"HIR pass", llvm::StringRef{pass->name().data(), pass->name().size()}};
+        auto changes = pass->run(p);
+        if (changes)
+            p.set_calls(build_call_graph(p));
+        if (stats)
+            stats->add_hir_pass(pass->name(), changes);
+    }
+}
+
+struct registered_pass {
+    std::string_view name;
+    std::shared_ptr<const hir_pass> (*make)();
+};
+
+static const registered_pass registered_passes[] = {
+    {"inline"sv, []() -> std::shared_ptr<const hir_pass> { return std::make_shared<inline_pass>(); }},
+    {"cse"sv, []() -> std::shared_ptr<const hir_pass> { return std::make_shared<cse_pass>(); }},
+    {"dce"sv, []() -> std::shared_ptr<const hir_pass> { return std::make_shared<dce_pass>(); }},
+};
+
+const std::vector<std::string_view> &hir_pass_names() {
+    static const std::vector<std::string_view> names = [] {
+        std::vector<std::string_view> result;
+        for (const auto &pass : registered_passes)
+            result.push_back(pass.name);
+        return result;
+    }();
+    return names;
+}
+
+std::optional<hir_pass_manager> make_hir_pipeline(std::string_view selection) {
+    std::unordered_set<std::string_view> selected;
+    llvm::StringRef rest{selection.data(), selection.size()};
+    while (!rest.empty()) {
+        auto [name, tail] = rest.split(',');
+        auto known = std::find_if(std::begin(registered_passes), std::end(registered_passes),
+            [&](const registered_pass &pass) { return pass.name == std::string_view{name.data(), name.size()}; });
+        if (known == std::end(registered_passes))
+            return std::nullopt;
+        selected.insert(known->name);
+        rest = tail;
+    }
+    hir_pass_manager result;
+    for (const auto &pass : registered_passes)
+        if (selected.contains(pass.name))
+            result.add(pass.make());
+    return result;
+}
+
+hir_pass_manager default_hir_pipeline() {
+    hir_pass_manager result;
+    for (const auto &pass : registered_passes)
+        result.add(pass.make());
+    return result;
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef CANNON_HIR_PASSES_HPP
+#define CANNON_HIR_PASSES_HPP
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "program.hpp"
+
+namespace cannon {
+
+class compile_stats;
+
+// One transformation of an analysed program. Passes hold no state of their own, so one pipeline
+// can serve several threads.
+class hir_pass {
+  public:
+    virtual ~hir_pass() = default;
+    [[nodiscard]] virtual std::string_view name() const noexcept = 0;
+    // Returns how many changes it made, for -fstats
+    virtual std::uint64_t run(program &p) const = 0;
+};
+
+// Runs its passes in the order they were added, between analyze() and codegen. The program's call
+// graph is brought up to date after every pass that changed something.
+class hir_pass_manager {
+  private:
+    std::vector<std::shared_ptr<const hir_pass>> m_passes;
+  public:
+    void add(std::shared_ptr<const hir_pass> pass);
+    [[nodiscard]] bool empty() const noexcept;
+    // The pass names in order, for cache keys
+    [[nodiscard]] std::string description() const;
+    void run(program &p, compile_stats *stats) const;
+};
+
+// The registered passes, in the order pipelines run them
+const std::vector<std::string_view> &hir_pass_names();
+
+// The pipeline for -fhir-passes=, a comma separated list of registered names, which run in
+// registration order whatever order they're listed in. Empty if a name isn't registered.
+std::optional<hir_pass_manager> make_hir_pipeline(std::string_view selection);
+
+// What optimization levels other than -O0 run without -fhir-passes=
+hir_pass_manager default_hir_pipeline();
+
+}
+
+#endif // CANNON_HIR_PASSES_HPP
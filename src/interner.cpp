@@ -0,0 +1,122 @@
+#include "interner.hpp"
+
+#include <bit>
+#include <cstring>
+#include <functional>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+namespace cannon {
+
+// Strings are copied into blocks of this size; longer ones than a quarter of it get their own
+static constexpr std::size_t arena_block_size = 64 * 1024;
+static constexpr std::size_t initial_table_size = 64;
+
+string_interner::table::table(std::size_t size)
+    : mask(size - 1), slots(std::make_unique<std::atomic<std::uint64_t>[]>(size)) {}
+
+string_interner::string_interner() : m_shards(std::make_unique<shard[]>(shard_count)) {}
+
+std::pair<std::size_t, std::size_t> string_interner::chunk_of(std::uint32_t index) noexcept {
+    std::size_t chunk = static_cast<std::size_t>(std::bit_width(index / first_chunk_size + 1)) - 1;
+    return {chunk, index - first_chunk_size * ((std::size_t{1} << chunk) - 1)};
+}
+
+std::string_view string_interner::entry(const shard &s, std::uint32_t index) noexcept {
+    auto [chunk, offset] = chunk_of(index);
+    return s.chunks[chunk].load(std::memory_order_acquire)[offset];
+}
+
+std::optional<std::uint32_t> string_interner::find(const shard &s, const table &t, std::uint64_t hash, std::string_view text) noexcept {
+    std::uint64_t tag = hash >> 32;
+    for (std::size_t i = (hash >> shard_bits) & t.mask;; i = (i + 1) & t.mask) {
+        // Acquire, so that the entry the slot points at is there too
+        std::uint64_t slot = t.slots[i].load(std::memory_order_acquire);
+        if (!slot)
+            return std::nullopt;
+        auto index = static_cast<std::uint32_t>(slot) - 1;
+        if (slot >> 32 == tag && entry(s, index) == text)
+            return index;
+    }
+}
+
+void string_interner::place(table &t, std::uint64_t hash, std::uint32_t index) noexcept {
+    std::size_t i = (hash >> shard_bits) & t.mask;
+    while (t.slots[i].load(std::memory_order_relaxed))
+        i = (i + 1) & t.mask;
+    t.slots[i].store((hash >> 32) << 32 | (std::uint64_t{index} + 1), std::memory_order_release);
+}
+
+std::string_view string_interner::store(shard &s, std::string_view text) {
+    if (text.size() > s.arena_left) {
+        if (text.size() > arena_block_size / 4) {
+            auto &block = s.arena.emplace_back(new char[text.size()]);
+            std::memcpy(block.get(), text.data(), text.size());
+            return {block.get(), text.size()};
+        }
+        s.arena_next = s.arena.emplace_back(new char[arena_block_size]).get();
+        s.arena_left = arena_block_size;
+    }
+    char *result = s.arena_next;
+    std::memcpy(result, text.data(), text.size());
+    s.arena_next += text.size();
+    s.arena_left -= text.size();
+    return {result, text.size()};
+}
+
+name_id string_interner::intern(std::string_view text) {
+    std::uint64_t hash = std::hash<std::string_view>{}(text);
+    auto shard_index = static_cast<std::uint32_t>(hash & (shard_count - 1));
+    shard &s = m_shards[shard_index];
+    auto id = [&](std::uint32_t index) -> name_id { return index << shard_bits | shard_index; };
+    if (auto *t = s.current.load(std::memory_order_acquire))
+        if (auto index = find(s, *t, hash, text))
+            return id(*index);
+
+    std::lock_guard lock{s.mutex};
+    // Another thread may have added it since
+    if (!s.tables.empty())
+        if (auto index = find(s, *s.tables.back(), hash, text))
+            return id(*index);
+    if (s.size == std::uint32_t{1} << (32 - shard_bits)) {
+        report({diagnostic_level::Error, {}, 0, 0, "Too many distinct names in one process"});
+        throw compiler_exit{1};
+    }
+
+    std::uint32_t index = s.size;
+    auto [chunk, offset] = chunk_of(index);
+    if (!s.chunks[chunk].load(std::memory_order_relaxed)) {
+        auto &storage = s.chunk_storage.emplace_back(std::make_unique<std::string_view[]>(first_chunk_size << chunk));
+        s.chunks[chunk].store(storage.get(), std::memory_order_release);
+    }
+    s.chunks[chunk].load(std::memory_order_relaxed)[offset] = store(s, text);
+
+    // Tables are kept at most half full, so that probes stay short. A full one is copied into one
+    // twice its size, which readers switch to once it's complete; they may still be on the old one,
+    // which just means they don't see the newest names and come here for them.
+    table *current = s.tables.empty() ? nullptr : s.tables.back().get();
+    if (!current || (std::size_t{index} + 1) * 2 > current->mask + 1) {
+        auto grown = std::make_unique<table>(current ? (current->mask + 1) * 2 : initial_table_size);
+        for (std::uint32_t i = 0; i < index; i++)
+            place(*grown, std::hash<std::string_view>{}(entry(s, i)), i);
+        place(*grown, hash, index);
+        current = s.tables.emplace_back(std::move(grown)).get();
+        s.current.store(current, std::memory_order_release);
+    } else {
+        place(*current, hash, index);
+    }
+    s.size++;
+    return id(index);
+}
+
+std::string_view string_interner::text(name_id id) const noexcept {
+    return entry(m_shards[id & (shard_count - 1)], id >> shard_bits);
+}
+
+string_interner &interned_names() {
+    static string_interner names;
+    return names;
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef CANNON_INTERNER_HPP
+#define CANNON_INTERNER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cannon {
+
+// A string interned by a string_interner. Equal strings get equal IDs, so names compare as integers.
+using name_id = std::uint32_t;
+
+// Maps strings to stable 32-bit IDs, keeping one copy of each in an arena, for any number of threads
+// at once. Strings are spread over shards by hash. Each shard's hash table is only ever replaced,
+// never changed in place apart from filling empty slots, so finding a string that's already interned
+// takes no lock; only adding a new one locks its shard. IDs and the views text() returns stay valid
+// as long as the interner.
+class string_interner {
+  private:
+    // An ID is an index into its shard's entries over the shard's number
+    static constexpr unsigned shard_bits = 6;
+    static constexpr std::size_t shard_count = std::size_t{1} << shard_bits;
+    // Each shard's entries are in chunks that double in size, so that entries never move. This many
+    // hold every index the bits above the shard number can express.
+    static constexpr std::size_t first_chunk_size = 256;
+    static constexpr std::size_t chunk_count = 19;
+
+    // Open addressing. A slot holds the top half of its string's hash over the string's index + 1, or
+    // 0 while empty.
+    struct table {
+        std::size_t mask;
+        std::unique_ptr<std::atomic<std::uint64_t>[]> slots;
+
+        explicit table(std::size_t size);
+    };
+
+    struct alignas(64) shard {
+        std::atomic<const table *> current{nullptr};
+        std::array<std::atomic<std::string_view *>, chunk_count> chunks{};
+        // Only touched with `mutex` held
+        std::mutex mutex;
+        std::uint32_t size{0};
+        std::vector<std::unique_ptr<table>> tables; // the current one last; readers may still be on the others
+        std::vector<std::unique_ptr<std::string_view[]>> chunk_storage;
+        std::vector<std::unique_ptr<char[]>> arena;
+        char *arena_next{nullptr};
+        std::size_t arena_left{0};
+    };
+
+    std::unique_ptr<shard[]> m_shards;
+
+    // Which chunk an entry is in, and where in it
+    static std::pair<std::size_t, std::size_t> chunk_of(std::uint32_t index) noexcept;
+    static std::string_view entry(const shard &s, std::uint32_t index) noexcept;
+    // The index of `text` in the shard, if `t` has it
+    static std::optional<std::uint32_t> find(const shard &s, const table &t, std::uint64_t hash, std::string_view text) noexcept;
+    static void place(table &t, std::uint64_t hash, std::uint32_t index) noexcept;
+    // Copies `text` into the shard's arena
+    static std::string_view store(shard &s, std::string_view text);
+  public:
+    string_interner();
+    string_interner(const string_interner &) = delete;
+    string_interner &operator=(const string_interner &) = delete;
+
+    name_id intern(std::string_view text);
+    // Takes no lock. `id` must have come from this interner.
+    [[nodiscard]] std::string_view text(name_id id) const noexcept;
+};
+
+// The interner that tokens and the identifiers of the AST and HIR share. It lives as long as the
+// process, so every thread of every compilation sees the same IDs.
+string_interner &interned_names();
+
+}
+
+#endif // CANNON_INTERNER_HPP
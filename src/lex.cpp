@@ -1,166 +1,180 @@
-#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include <llvm/Support/TimeProfiler.h>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
 #include "lex.hpp"
 
 namespace cannon {
 
-static char next_char(uint64_t &line, uint32_t &col, std::istream &input) {
-    char next;
-    input.get(next);
-    if (next == '\n') {
-        line++;
-        col = 0;
-    }
-    col++; // If newline, sets col to 1
-    if (input.eof())
-        return '\0'; // Nobody is going to sensibly put a \0 in their code, and if
-                     // they do, it should validly be EOF.
-    return next;
+// The character at `pos`, or '\0' past the end. Nobody is going to sensibly put a \0 in their code,
+// and if they do, it should validly be EOF.
+static char char_at(std::string_view text, std::uint64_t pos) {
+    return pos < text.size() ? text[pos] : '\0';
+}
+
+static bool is_identifier_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
 }
 
-std::vector<token> lex(std::istream &input) {
-    auto result = std::vector<token>();
-    uint64_t line = 1; // Why no 0 index? AAAA
-    uint32_t col = 1;  // AAAA AAAA
+static bool is_hex_digit(char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+lexer::lexer(const source_file &file, literal_table &literals, std::uint64_t begin)
+    : m_file(file), m_literals(literals), m_pos(begin) {}
+
+std::uint64_t lexer::offset() const noexcept {
+    return m_pos;
+}
+
+std::optional<token> lexer::next_token() {
+    std::string_view text = m_file.contents();
 
-    uint64_t cur_line = line;
-    uint32_t cur_col = col;
-    char c = next_char(line, col, input); // the current char
+    std::uint64_t &pos = m_pos; // of c
+    char c = char_at(text, pos); // the current char
+    auto next = [&] { c = char_at(text, ++pos); };
     while (c != '\0') {
+        std::uint64_t start = pos;
+        auto push = [&](token_type type, std::uint32_t literal = 0) {
+            return token{m_file.location_at(start), text.substr(start, pos - start), type, literal};
+        };
+        auto fail = [&](std::string message) {
+            report({diagnostic_level::Error, {}, 0, 0, std::move(message), m_file.location_at(start)});
+            throw compiler_exit{1};
+        };
         if ( // <c>
             c == '{' || c == '}' || c == '(' || c == ')' ||
             c == ';' || c == ',' || c == '.' || c == '\'' || c == '"'
         ) {
-            std::string data(1, c);
-            token t{cur_line, cur_col, data, SYMBOL};
-            result.push_back(t);
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
+            next();
+            return push(SYMBOL);
         } else if ( // <c>=, <c>
             c == '=' || c == '*' || c == '%' || c == '^' || c == '!' || c == '~'
         ) {
-            std::string tok_str(1, c);
-            uint64_t tmp_cur_line = cur_line;
-            uint32_t tmp_cur_col = cur_col;
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
-            if (c == '=') {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
-            }
-            token t{tmp_cur_line, tmp_cur_col, tok_str, SYMBOL};
-            result.push_back(t);
+            next();
+            if (c == '=')
+                next();
+            return push(SYMBOL);
         } else if (c == '/') { // /=, //, /
-            std::string tok_str(1, c);
-            uint64_t tmp_cur_line = cur_line;
-            uint32_t tmp_cur_col = cur_col;
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
+            next();
             if (c == '=') {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
+                next();
             } else if (c == '/') {
-                while (
-                    c !=
-                    '\n') { // Nobody needs to know the contents of the comment
-                    cur_line = line;
-                    cur_col = col;
-                    c = next_char(line, col, input);
-                }
-                continue; // We don't need to store that there was a comment; that's not helpful.
+                // Nobody needs to know the contents of the comment, nor that there was one
+                while (c != '\n' && c != '\0')
+                    next();
+                continue;
             } // I have not decided how to tokenize multilines yet
-            token t{tmp_cur_line, tmp_cur_col, tok_str, SYMBOL};
-            result.push_back(t);
+            return push(SYMBOL);
         } else if ( // <c><c>, <c>=, <c>, ->
             c == '&' || c == '|' || c == '+' || c == '-'
         ) {
             char firstc = c;
-            std::string tok_str(1, c);
-            uint64_t tmp_cur_line = cur_line;
-            uint32_t tmp_cur_col = cur_col;
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
-            if (c == '=' || c == firstc ||
-                (firstc == '-' && c == '>')) {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
-            }
-            token t{tmp_cur_line, tmp_cur_col, tok_str, SYMBOL};
-            result.push_back(t);
+            next();
+            if (c == '=' || c == firstc || (firstc == '-' && c == '>'))
+                next();
+            return push(SYMBOL);
         } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
+            next();
         } else if (c == '>' || c == '<') {
             char firstc = c;
-            std::string tok_str(1, c);
-            uint64_t tmp_cur_line = cur_line;
-            uint32_t tmp_cur_col = cur_col;
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
-            if (c == firstc) {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
+            next();
+            if (c == firstc)
+                next();
+            if (c == '=')
+                next();
+            return push(SYMBOL);
+        } else if (is_digit(c)) {
+            // Decoded here, once, so nothing after the lexer looks at the digits again
+            unsigned base = 10;
+            char prefix = char_at(text, pos + 1);
+            if (c == '0' && (prefix == 'x' || prefix == 'X' || prefix == 'b' || prefix == 'B')) {
+                base = prefix == 'x' || prefix == 'X' ? 16 : 2;
+                next();
+                next();
             }
-            if (c == '=') {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
+            std::uint64_t digits_start = pos;
+            // Binary literals take any decimal digit, so that 0b102 is an error rather than two numbers
+            while ((base == 16 ? is_hex_digit(c) : is_digit(c)) || c == '_')
+                next();
+            if (pos == digits_start)
+                fail("Expected digits after \"" + std::string{text.substr(start, pos - start)} + "\"");
+
+            bool is_float = false;
+            if (base == 10 && c == '.' && is_digit(char_at(text, pos + 1))) {
+                is_float = true;
+                next();
+                while (is_digit(c) || c == '_')
+                    next();
             }
-            token t{tmp_cur_line, tmp_cur_col, tok_str, SYMBOL};
-            result.push_back(t);
-        } else if (c >= '0' && c <= '9') {
-            std::string tok_str(1, c);
-            uint64_t tmp_cur_line = cur_line;
-            uint32_t tmp_cur_col = cur_col;
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
-            while (c >= '0' && c <= '9') {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
+            if (base == 10 && (c == 'e' || c == 'E')) {
+                std::uint64_t exponent = pos + 1;
+                if (char_at(text, exponent) == '+' || char_at(text, exponent) == '-')
+                    exponent++;
+                if (is_digit(char_at(text, exponent))) {
+                    is_float = true;
+                    while (pos < exponent)
+                        next();
+                    while (is_digit(c) || c == '_')
+                        next();
+                }
             }
-            token t{tmp_cur_line, tmp_cur_col, tok_str, NUMBER};
-            result.push_back(t);
-        } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$') {
-            std::string tok_str(1, c);
-            uint64_t tmp_cur_line = cur_line;
-            uint32_t tmp_cur_col = cur_col;
-            cur_line = line;
-            cur_col = col;
-            c = next_char(line, col, input);
-            while ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$') {
-                tok_str.push_back(c);
-                cur_line = line;
-                cur_col = col;
-                c = next_char(line, col, input);
+
+            std::string_view literal = text.substr(start, pos - start);
+            if (is_float) {
+                auto value = decode_float(literal);
+                if (!value)
+                    fail("Floating point literal " + std::string{literal} + " is out of range");
+                m_literals.floats.push_back(*value);
+                return push(FLOAT, static_cast<std::uint32_t>(m_literals.floats.size() - 1));
+            } else {
+                auto digits = text.substr(digits_start, pos - digits_start);
+                auto value = decode_integer(digits, base);
+                if (!value) {
+                    bool bad_digit = base == 2 && digits.find_first_of("23456789") != std::string_view::npos;
+                    fail(bad_digit ? "Invalid digit in binary literal " + std::string{literal}
+                        : "Integer literal " + std::string{literal} + " doesn't fit in 128 bits");
+                }
+                m_literals.integers.push_back(*value);
+                return push(NUMBER, static_cast<std::uint32_t>(m_literals.integers.size() - 1));
             }
-            token t{tmp_cur_line, tmp_cur_col, tok_str, IDENTIFIER};
-            result.push_back(t);
+        } else if (is_identifier_start(c)) {
+            next();
+            while (is_identifier_start(c) || is_digit(c))
+                next();
+            return push(IDENTIFIER);
         } else {
-            std::cerr << "FATAL: Invalid character '" << c << "'!";
-            throw "Invalid character"; // FIXME: Don't use exceptions
+            report({diagnostic_level::Error, {}, 0, 0, std::string{"Invalid character '"} + c + "'", m_file.location_at(pos)});
+            throw compiler_exit{1};
         }
     }
+    return std::nullopt;
+}
+
+lexed_file lex(const source_file &file, std::uint64_t begin, std::uint64_t end) {
+    llvm::TimeTraceScope trace{"Lex"};
+    lexed_file lexed;
+    lexer tokens{file, lexed.literals, begin};
+    while (tokens.offset() < end) {
+        auto next = tokens.next_token();
+        if (!next)
+            break;
+        lexed.tokens.push_back(std::move(*next));
+    }
+    return lexed;
+}
 
-    return result;
+lexed_file lex(const source_file &file) {
+    return lex(file, 0, file.contents().size());
 }
 
 } // namespace cannon
@@ -1,14 +1,42 @@
 #ifndef CANNON_LEX_HPP
 #define CANNON_LEX_HPP
 
-#include <iostream>
+#include <cstdint>
+#include <optional>
 #include <vector>
 
+#include "literal.hpp"
+#include "source.hpp"
 #include "token.hpp"
 
 namespace cannon {
 
-std::vector<token> lex(std::istream &input);
+struct lexed_file {
+    std::vector<token> tokens;
+    literal_table literals;
+};
+
+// Hands out the tokens of `file` one at a time, starting at offset `begin`, for callers that
+// don't want to hold all of them at once. Literal values are added to `literals`.
+class lexer {
+  private:
+    const source_file &m_file;
+    literal_table &m_literals;
+    std::uint64_t m_pos;
+  public:
+    lexer(const source_file &file, literal_table &literals, std::uint64_t begin = 0);
+    // Empty at the end of the file
+    std::optional<token> next_token();
+    // Where the next token's search starts, just past the last one returned
+    [[nodiscard]] std::uint64_t offset() const noexcept;
+};
+
+// Token locations point into `file`
+lexed_file lex(const source_file &file);
+
+// The tokens that start in [begin, end) of `file`, as long as `begin` is where a token or the
+// space before one starts
+lexed_file lex(const source_file &file, std::uint64_t begin, std::uint64_t end);
 
 }
 
@@ -0,0 +1,313 @@
+#include "link.hpp"
+
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <lld/Common/Driver.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include <lld/Common/CommonLinkerContext.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+// An object handed to a linker by path. On Linux it is an anonymous memfd, which the linker (or
+// the external linker's process, which inherits the descriptor) opens through /proc/self/fd;
+// elsewhere it falls back to a temporary file that is removed again afterwards.
+class linker_input {
+  private:
+    std::string m_path;
+    int m_fd{-1};
+    bool m_temporary{false};
+  public:
+    explicit linker_input(const llvm::MemoryBuffer &object) {
+#ifdef __linux__
+        m_fd = memfd_create(object.getBufferIdentifier().str().c_str(), 0);
+        if (m_fd >= 0) {
+            m_path = "/proc/self/fd/" + std::to_string(m_fd);
+            llvm::raw_fd_ostream out(m_fd, false);
+            out << object.getBuffer();
+            return;
+        }
+#endif
+        llvm::SmallString<128> path;
+        if (auto error = llvm::sys::fs::createTemporaryFile("cannon", "o", m_fd, path)) {
+            report({diagnostic_level::Error, {}, 0, 0, "Failed to create a temporary object: " + error.message()});
+            throw compiler_exit{1};
+        }
+        m_path = std::string{path};
+        m_temporary = true;
+        llvm::raw_fd_ostream out(m_fd, false);
+        out << object.getBuffer();
+    }
+    linker_input(const linker_input &) = delete;
+    linker_input &operator=(const linker_input &) = delete;
+    ~linker_input() {
+        llvm::sys::Process::SafelyCloseFileDescriptor(m_fd);
+        if (m_temporary)
+            llvm::sys::fs::remove(m_path);
+    }
+    const std::string &path() const {
+        return m_path;
+    }
+};
+
+static void write_static_lib(const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &objects, const link_options &options) {
+    std::vector<llvm::NewArchiveMember> members;
+    for (const auto &object : objects)
+        members.emplace_back(object->getMemBufferRef());
+    auto kind = options.triple.isOSDarwin() ? llvm::object::Archive::K_DARWIN : llvm::object::Archive::K_GNU;
+    if (auto error = llvm::writeArchive(options.output, members, true, kind, true, false)) {
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to write " + options.output + ": " + llvm::toString(std::move(error))});
+        throw compiler_exit{1};
+    }
+}
+
+static std::string in_sysroot(const link_options &options, std::string_view path) {
+    return options.sysroot ? *options.sysroot + std::string{path} : std::string{path};
+}
+
+// Where the C runtime and libc live, most specific first
+static std::vector<std::string> system_lib_dirs(const link_options &options) {
+    std::string multiarch = options.triple.getArchName().str() + "-linux-" + options.triple.getEnvironmentName().str();
+    std::vector<std::string> result;
+    for (auto dir : {"/usr/lib/"sv, "/lib/"sv})
+        result.push_back(in_sysroot(options, std::string{dir} + multiarch));
+    if (options.triple.isArch64Bit()) {
+        result.push_back(in_sysroot(options, "/usr/lib64"sv));
+        result.push_back(in_sysroot(options, "/lib64"sv));
+    }
+    result.push_back(in_sysroot(options, "/usr/lib"sv));
+    result.push_back(in_sysroot(options, "/lib"sv));
+    return result;
+}
+
+static std::string find_crt_object(const link_options &options, std::string_view name) {
+    for (const auto &dir : system_lib_dirs(options)) {
+        llvm::SmallString<128> path{dir};
+        llvm::sys::path::append(path, name);
+        if (llvm::sys::fs::exists(path))
+            return std::string{path};
+    }
+    report({diagnostic_level::Error, {}, 0, 0, "Cannot find " + std::string{name} + " for " + options.triple.str() + "; set --sysroot or use -fuse-ld="});
+    throw compiler_exit{1};
+}
+
+static bool is_shared(link_type type) {
+    return type == link_type::SharedLib || type == link_type::SharedModule;
+}
+
+static std::string dynamic_linker(const llvm::Triple &triple) {
+    if (triple.isMusl())
+        return "/lib/ld-musl-" + triple.getArchName().str() + ".so.1";
+    switch (triple.getArch()) {
+      case llvm::Triple::x86_64:
+        return "/lib64/ld-linux-x86-64.so.2";
+      case llvm::Triple::x86:
+        return "/lib/ld-linux.so.2";
+      case llvm::Triple::aarch64:
+        return "/lib/ld-linux-aarch64.so.1";
+      case llvm::Triple::riscv64:
+        return "/lib/ld-linux-riscv64-lp64d.so.1";
+      default:
+        report({diagnostic_level::Error, {}, 0, 0, "Don't know the dynamic linker for " + triple.str() + "; use -fuse-ld="});
+        throw compiler_exit{1};
+    }
+}
+
+static void run_lld(const std::vector<std::string> &args) {
+    std::vector<const char *> argv;
+    for (const auto &arg : args)
+        argv.push_back(arg.c_str());
+    // lld's messages become diagnostics, like everything else the compiler reports
+    std::string output;
+    std::string messages;
+    llvm::raw_string_ostream output_stream{output};
+    llvm::raw_string_ostream message_stream{messages};
+#if LLVM_VERSION_MAJOR >= 14
+    bool linked = lld::elf::link(argv, output_stream, message_stream, false, false);
+    lld::CommonLinkerContext::destroy();
+#else
+    bool linked = lld::elf::link(argv, false, output_stream, message_stream);
+#endif
+    compiler_out() << output_stream.str();
+    llvm::StringRef text = llvm::StringRef{message_stream.str()}.rtrim();
+    if (!linked) {
+        report({diagnostic_level::Error, {}, 0, 0, text.empty() ? std::string{"Linking failed"} : text.str()});
+        throw compiler_exit{1};
+    }
+    if (!text.empty())
+        report({diagnostic_level::Warning, {}, 0, 0, text.str()});
+}
+
+// Runs the system C compiler driver with `args`, which start with its name
+static void run_external(const std::vector<std::string> &args) {
+    auto driver = llvm::sys::findProgramByName("cc");
+    if (!driver) {
+        report({diagnostic_level::Error, {}, 0, 0, "Cannot find a C compiler driver to link with"});
+        throw compiler_exit{1};
+    }
+    std::vector<llvm::StringRef> argv(args.begin(), args.end());
+    std::string error;
+    int status = llvm::sys::ExecuteAndWait(*driver, argv, llvm::None, {}, 0, 0, &error);
+    if (status != 0) {
+        if (!error.empty())
+            report({diagnostic_level::Error, {}, 0, 0, "Failed to run the linker: " + error});
+        throw compiler_exit{1};
+    }
+}
+
+static void link_elf_with_lld(const std::deque<linker_input> &inputs, const link_options &options) {
+    std::vector<std::string> args{"ld.lld", "--eh-frame-hdr", "-o", options.output};
+    if (options.sysroot)
+        args.push_back("--sysroot=" + *options.sysroot);
+    if (is_shared(options.type)) {
+        args.push_back("-shared");
+    } else {
+        args.push_back("-pie");
+        args.push_back("-dynamic-linker");
+        args.push_back(dynamic_linker(options.triple));
+        args.push_back(find_crt_object(options, "Scrt1.o"));
+    }
+    args.push_back(find_crt_object(options, "crti.o"));
+    for (const auto &dir : options.libdirs)
+        args.push_back("-L" + dir);
+    for (const auto &dir : system_lib_dirs(options))
+        args.push_back("-L" + dir);
+    for (const auto &symbol : options.undefined_symbols) {
+        args.push_back("-u");
+        args.push_back(symbol);
+    }
+    for (const auto &input : inputs)
+        args.push_back(input.path());
+    for (const auto &lib : options.libs)
+        args.push_back("-l" + lib);
+    for (const auto &lib : options.runtime_libs)
+        args.push_back(lib);
+    args.push_back("-lc");
+    args.push_back(find_crt_object(options, "crtn.o"));
+
+    run_lld(args);
+}
+
+static void link_with_external(const std::deque<linker_input> &inputs, const link_options &options) {
+    std::vector<std::string> args{"cc", "-o", options.output};
+    if (!options.linker.empty())
+        args.push_back("-fuse-ld=" + options.linker);
+    if (is_shared(options.type))
+        args.push_back("-shared");
+    if (options.sysroot)
+        args.push_back("--sysroot=" + *options.sysroot);
+    for (const auto &dir : options.libdirs)
+        args.push_back("-L" + dir);
+    for (const auto &symbol : options.undefined_symbols) {
+        args.push_back("-u");
+        args.push_back(symbol);
+    }
+    for (const auto &input : inputs)
+        args.push_back(input.path());
+    for (const auto &lib : options.libs)
+        args.push_back("-l" + lib);
+    for (const auto &lib : options.runtime_libs)
+        args.push_back(lib);
+    run_external(args);
+}
+
+void link(const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &objects, const link_options &options) {
+    llvm::TimeTraceScope trace{"Link", options.output};
+    switch (options.type) {
+      case link_type::StaticLib:
+      case link_type::JoinedModule:
+        write_static_lib(objects, options);
+        return;
+      case link_type::Exec:
+      case link_type::SharedLib:
+      case link_type::SharedModule:
+        break;
+      default:
+        report({diagnostic_level::Error, {}, 0, 0, "Partial module links are not supported yet"});
+        throw compiler_exit{1};
+    }
+
+    std::deque<linker_input> inputs;
+    for (const auto &object : objects)
+        inputs.emplace_back(*object);
+
+    // lld is only driven in-process for ELF; other object formats need the platform's driver
+    bool integrated = options.linker.empty() || options.linker == "lld";
+    if (integrated && options.triple.isOSBinFormatELF())
+        link_elf_with_lld(inputs, options);
+    else
+        link_with_external(inputs, options);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> join_objects(const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &objects,
+        const link_options &options) {
+    if (objects.size() == 1)
+        return llvm::MemoryBuffer::getMemBufferCopy(objects.front()->getBuffer(), objects.front()->getBufferIdentifier());
+    llvm::TimeTraceScope trace{"Join objects"};
+    std::deque<linker_input> inputs;
+    for (const auto &object : objects)
+        inputs.emplace_back(*object);
+
+    // Linkers replace their output rather than writing into it, so it goes through a real file
+    int fd;
+    llvm::SmallString<128> path;
+    if (auto error = llvm::sys::fs::createTemporaryFile("cannon", "o", fd, path)) {
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to create a temporary object: " + error.message()});
+        throw compiler_exit{1};
+    }
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    llvm::FileRemover remover{path};
+
+    bool integrated = (options.linker.empty() || options.linker == "lld") && options.triple.isOSBinFormatELF();
+    std::vector<std::string> args;
+    if (integrated) {
+        args = {"ld.lld", "-r", "-o", std::string{path}};
+    } else {
+        args = {"cc", "-r", "-nostdlib", "-o", std::string{path}};
+        if (!options.linker.empty())
+            args.push_back("-fuse-ld=" + options.linker);
+        if (options.sysroot)
+            args.push_back("--sysroot=" + *options.sysroot);
+    }
+    for (const auto &input : inputs)
+        args.push_back(input.path());
+    if (integrated)
+        run_lld(args);
+    else
+        run_external(args);
+
+    auto joined = llvm::MemoryBuffer::getFile(path);
+    if (!joined) {
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to read the joined object: " + joined.getError().message()});
+        throw compiler_exit{1};
+    }
+    return std::move(*joined);
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef CANNON_LINK_HPP
+#define CANNON_LINK_HPP
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "mode.hpp"
+
+namespace cannon {
+
+struct link_options {
+    link_type type{link_type::Exec};
+    std::string output;
+    llvm::Triple triple;
+    std::vector<std::string> libs{};
+    std::vector<std::string> libdirs{};
+    std::optional<std::string> sysroot{};
+    // Empty or "lld" links in-process with lld; anything else is handed to the system C compiler
+    // driver as -fuse-ld=<linker>
+    std::string linker{};
+    // Archives linked after everything else, like the profile runtime for -fprofile-generate
+    std::vector<std::string> runtime_libs{};
+    // Symbols to pull in from runtime_libs even though no object refers to them
+    std::vector<std::string> undefined_symbols{};
+};
+
+// Links the in-memory `objects` into options.output. Objects are never written to disk: static
+// libraries are assembled in memory, and linkers are given anonymous in-memory files where the
+// platform supports them.
+void link(const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &objects, const link_options &options);
+
+// Joins objects compiled from pieces of one input into a single relocatable object, as `ld -r` does,
+// with the linker `options` names. Only the triple, linker and sysroot are used.
+std::unique_ptr<llvm::MemoryBuffer> join_objects(const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &objects,
+    const link_options &options);
+
+}
+
+#endif // CANNON_LINK_HPP
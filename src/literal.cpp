@@ -0,0 +1,70 @@
+#include "literal.hpp"
+
+#include <charconv>
+#include <limits>
+#include <string>
+#include <system_error>
+
+namespace cannon {
+
+static constexpr std::uint64_t uint64_max = std::numeric_limits<std::uint64_t>::max();
+
+static std::optional<unsigned> digit_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return std::nullopt;
+}
+
+// value = value * base + digit, or false on overflow. `base` is small, so `low * base` is worked
+// out in 32-bit halves to find its carry.
+static bool multiply_add(uint128 &value, unsigned base, unsigned digit) {
+    std::uint64_t low_half = (value.low & 0xFFFFFFFF) * base;
+    std::uint64_t high_half = (value.low >> 32) * base + (low_half >> 32);
+    std::uint64_t carry = high_half >> 32;
+    if (value.high > (uint64_max - carry) / base)
+        return false;
+    value.high = value.high * base + carry;
+    value.low = (high_half << 32) | (low_half & 0xFFFFFFFF);
+
+    value.low += digit;
+    if (value.low < digit) {
+        if (value.high == uint64_max)
+            return false;
+        value.high++;
+    }
+    return true;
+}
+
+std::optional<uint128> decode_integer(std::string_view digits, unsigned base) {
+    uint128 result;
+    for (char c : digits) {
+        if (c == '_')
+            continue;
+        auto digit = digit_value(c);
+        if (!digit || *digit >= base || !multiply_add(result, base, *digit))
+            return std::nullopt;
+    }
+    return result;
+}
+
+std::optional<double> decode_float(std::string_view text) {
+    // from_chars doesn't take separators, so only literals that have them pay for a copy
+    std::string without_separators;
+    if (text.find('_') != std::string_view::npos) {
+        for (char c : text)
+            if (c != '_')
+                without_separators.push_back(c);
+        text = without_separators;
+    }
+    double result;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), result);
+    if (error != std::errc{} || end != text.data() + text.size())
+        return std::nullopt;
+    return result;
+}
+
+}
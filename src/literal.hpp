@@ -0,0 +1,35 @@
+#ifndef CANNON_LITERAL_HPP
+#define CANNON_LITERAL_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace cannon {
+
+// The value of an integer literal, which may be wider than any type the language has yet
+struct uint128 {
+    std::uint64_t high{0};
+    std::uint64_t low{0};
+
+    auto operator<=>(const uint128 &) const = default;
+};
+
+// Decodes the digits of an integer literal in `base` (2, 10 or 16), skipping '_' separators. Empty
+// if it doesn't fit in 128 bits or has a digit outside the base.
+std::optional<uint128> decode_integer(std::string_view digits, unsigned base);
+
+// Decodes a decimal floating point literal, correctly rounded. Empty if it is out of range.
+std::optional<double> decode_float(std::string_view text);
+
+// The values of a file's numeric literals, decoded once by the lexer. NUMBER and FLOAT tokens
+// hold an index into `integers` and `floats` respectively.
+struct literal_table {
+    std::vector<uint128> integers;
+    std::vector<double> floats;
+};
+
+}
+
+#endif // CANNON_LITERAL_HPP
@@ -0,0 +1,125 @@
+#include "lto.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/LTO/LTO.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/Support/Caching.h>
+#else
+#include <llvm/LTO/Caching.h>
+#endif
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+namespace cannon {
+
+#if LLVM_VERSION_MAJOR >= 14
+using object_stream = llvm::CachedFileStream;
+#else
+using object_stream = llvm::lto::NativeObjectStream;
+#endif
+
+[[noreturn]] static void lto_error(llvm::Error error) {
+    report({diagnostic_level::Error, {}, 0, 0, "ThinLTO failed: " + llvm::toString(std::move(error))});
+    throw compiler_exit{1};
+}
+
+std::vector<std::unique_ptr<llvm::MemoryBuffer>> thin_lto_link(const std::vector<llvm::MemoryBufferRef> &modules,
+        llvm::TargetMachine &targetMachine, const thin_lto_options &options) {
+    llvm::TimeTraceScope trace{"ThinLTO link"};
+    llvm::lto::Config config;
+    config.CPU = targetMachine.getTargetCPU().str();
+    llvm::SmallVector<llvm::StringRef, 8> features;
+    targetMachine.getTargetFeatureString().split(features, ',', -1, false);
+    for (auto feature : features)
+        config.MAttrs.push_back(feature.str());
+    config.Options = targetMachine.Options;
+    config.RelocModel = targetMachine.getRelocationModel();
+    config.DefaultTriple = targetMachine.getTargetTriple().str();
+    config.OptLevel = llvm_opt_level(options.codegen.opt_level);
+    config.CGOptLevel = static_cast<llvm::CodeGenOpt::Level>(config.OptLevel);
+
+    llvm::lto::LTO lto(std::move(config), llvm::lto::createInProcessThinBackend(llvm::heavyweight_hardware_concurrency(options.jobs)));
+
+    // Every module is compiled by us, so the first definition of a symbol wins and nothing but the
+    // entry point (or everything, for libraries) has to survive internalization.
+    std::set<std::string> defined;
+    for (auto module : modules) {
+        // Bitcode without a summary would go to the regular LTO partition, which isn't emitted
+        auto info = llvm::getBitcodeLTOInfo(module);
+        if (!info)
+            lto_error(info.takeError());
+        if (!info->IsThinLTO) {
+            report({diagnostic_level::Error, module.getBufferIdentifier().str(), 0, 0,
+                "Bitcode without a ThinLTO summary cannot be linked with -flto=thin; compile it with -flto=thin"});
+            throw compiler_exit{1};
+        }
+        auto input = llvm::lto::InputFile::create(module);
+        if (!input)
+            lto_error(input.takeError());
+        std::vector<llvm::lto::SymbolResolution> resolutions;
+        for (const auto &symbol : (*input)->symbols()) {
+            llvm::lto::SymbolResolution resolution;
+            if (!symbol.isUndefined()) {
+                resolution.Prevailing = defined.insert(symbol.getName().str()).second;
+                resolution.FinalDefinitionInLinkageUnit = true;
+            }
+            resolution.VisibleToRegularObj = options.export_all || symbol.getName() == "main";
+            resolutions.push_back(resolution);
+        }
+        if (auto error = lto.add(std::move(*input), resolutions))
+            lto_error(std::move(error));
+    }
+
+    // Backends run on a thread pool and may finish (or hit the cache) in any order
+    std::mutex results_mutex;
+    std::vector<llvm::SmallVector<char, 0>> streamed(lto.getMaxTasks());
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> cached(lto.getMaxTasks());
+    auto add_stream = [&](unsigned task) {
+        return std::make_unique<object_stream>(std::make_unique<llvm::raw_svector_ostream>(streamed[task]));
+    };
+    auto add_buffer = [&](unsigned task, std::unique_ptr<llvm::MemoryBuffer> buffer) {
+        std::lock_guard lock{results_mutex};
+        cached[task] = std::move(buffer);
+    };
+
+    if (options.cache_dir.empty()) {
+        if (auto error = lto.run(add_stream))
+            lto_error(std::move(error));
+    } else {
+#if LLVM_VERSION_MAJOR >= 14
+        auto cache = llvm::localCache("ThinLTO", "Thin", options.cache_dir, add_buffer);
+#else
+        auto cache = llvm::lto::localCache(options.cache_dir, add_buffer);
+#endif
+        if (!cache)
+            lto_error(cache.takeError());
+        if (auto error = lto.run(add_stream, *cache))
+            lto_error(std::move(error));
+    }
+
+    // The regular LTO partitions come first and are empty, since every module has a summary. The
+    // ThinLTO tasks follow, one per module in the order they were added.
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> result;
+    for (std::size_t i = 0; i < modules.size(); i++) {
+        std::size_t task = streamed.size() - modules.size() + i;
+        if (cached[task])
+            result.push_back(std::move(cached[task]));
+        else
+            result.push_back(llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(streamed[task].data(), streamed[task].size())));
+    }
+    return result;
+}
+
+}
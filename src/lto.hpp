@@ -0,0 +1,30 @@
+#ifndef CANNON_LTO_HPP
+#define CANNON_LTO_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "codegen.hpp"
+
+namespace cannon {
+
+struct thin_lto_options {
+    codegen_options codegen{};
+    unsigned jobs{0};      // 0 means one backend thread per hardware thread
+    std::string cache_dir{}; // empty disables the cache
+    bool export_all{false};  // keep every definition visible, not just main (for libraries)
+};
+
+// Runs the ThinLTO link over `modules`, which must be bitcode written with a ThinLTO summary.
+// Functions are imported across modules and the backends run in parallel; the result is one native
+// object per input module, in the same order. Bitcode without a summary is an error.
+std::vector<std::unique_ptr<llvm::MemoryBuffer>> thin_lto_link(const std::vector<llvm::MemoryBufferRef> &modules,
+        llvm::TargetMachine &target_machine, const thin_lto_options &options);
+
+}
+
+#endif // CANNON_LTO_HPP
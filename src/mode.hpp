@@ -21,8 +21,8 @@ enum class compiler_mode {
 
 enum class link_type {
     Exec,
-    JoinedModule, // .tbd
-    SharedModule, // .so/.dll, with a tbd section
+    JoinedModule, // .a, with a .tbd module interface beside it (see module_interface.hpp)
+    SharedModule, // .so/.dll, with a .tbd module interface beside it
     StaticLib,    // .a/.lib, usable with C/not-cannon
     SharedLib,    // .so/.dll, usable with C/not-cannon, no cannon module information
     Partial,      // .tbd or .tbd2, but incomplete
@@ -43,6 +43,17 @@ enum class optimization_level {
     Extra = 255
 };
 
+enum class emit_kind {
+    Object,
+    Bitcode, // -c/--compile-only: optimized IR, without running the machine backend
+    IRText,  // -c -S: the same, as textual .ll
+};
+
+enum class lto_mode {
+    None,
+    Thin, // -flto=thin: per-module summaries at compile time, parallel ThinLTO backend at link time
+};
+
 } // namespace cannon
 
 #endif // CANNON_MODE_HPP
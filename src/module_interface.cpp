@@ -0,0 +1,159 @@
+#include "module_interface.hpp"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <string>
+
+#include <llvm/Support/Endian.h>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+// Bump the version whenever the layout below changes
+static constexpr std::string_view interface_magic = "CTBD"sv;
+static constexpr std::uint32_t interface_version = 1;
+
+// magic, version, function count, string table size
+static constexpr std::size_t header_size = 16;
+// name offset, name size, symbol offset, symbol size, then return type, parameter count and two
+// bytes of padding
+static constexpr std::size_t record_size = 20;
+
+static std::uint32_t read32(const char *data) {
+    return llvm::support::endian::read32le(data);
+}
+
+static void write32(llvm::raw_ostream &out, std::uint32_t value) {
+    std::array<char, 4> bytes;
+    llvm::support::endian::write32le(bytes.data(), value);
+    out.write(bytes.data(), bytes.size());
+}
+
+module_interface::module_interface(std::unique_ptr<llvm::MemoryBuffer> buffer, std::uint32_t function_count)
+    : m_buffer(std::move(buffer)), m_function_count(function_count) {}
+
+module_interface module_interface::load(std::string_view path) {
+    // Interfaces are never modified in place, so large ones can stay mapped
+    auto buffer = llvm::MemoryBuffer::getFile(path, false, false);
+    if (!buffer) {
+        report({diagnostic_level::Error, std::string{path}, 0, 0, "Failed to read: " + buffer.getError().message()});
+        throw compiler_exit{1};
+    }
+    auto fail = [&](std::string_view why) {
+        report({diagnostic_level::Error, std::string{path}, 0, 0, "Not a usable module interface: " + std::string{why}});
+        throw compiler_exit{1};
+    };
+
+    llvm::StringRef contents = (*buffer)->getBuffer();
+    if (contents.size() < header_size || !contents.startswith(interface_magic))
+        fail("bad header"sv);
+    if (read32(contents.data() + 4) != interface_version)
+        fail("written by a different version of Cannon"sv);
+    std::uint64_t function_count = read32(contents.data() + 8);
+    std::uint64_t strings_size = read32(contents.data() + 12);
+    std::uint64_t strings_offset = header_size + function_count * record_size;
+    if (strings_offset + strings_size != contents.size())
+        fail("truncated"sv);
+
+    module_interface result{std::move(*buffer), static_cast<std::uint32_t>(function_count)};
+    // Records only point into the string table; checking that once keeps lookups unchecked
+    for (std::uint32_t i = 0; i < result.m_function_count; i++) {
+        const char *record = contents.data() + header_size + i * record_size;
+        for (std::size_t field : {0, 8}) {
+            std::uint64_t offset = read32(record + field), size = read32(record + field + 4);
+            if (offset + size > strings_size)
+                fail("string out of bounds"sv);
+        }
+    }
+    return result;
+}
+
+function_signature module_interface::function_at(std::uint32_t index) const {
+    const char *data = m_buffer->getBufferStart();
+    const char *strings = data + header_size + m_function_count * record_size;
+    const char *record = data + header_size + index * record_size;
+    return function_signature{
+        std::string_view{strings + read32(record), read32(record + 4)},
+        std::string_view{strings + read32(record + 8), read32(record + 12)},
+        static_cast<type_id>(static_cast<unsigned char>(record[16])),
+        static_cast<std::uint8_t>(record[17]),
+    };
+}
+
+std::optional<function_signature> module_interface::find(std::string_view name) const {
+    std::uint32_t low = 0, high = m_function_count;
+    while (low < high) {
+        std::uint32_t mid = low + (high - low) / 2;
+        auto candidate = function_at(mid);
+        if (candidate.name == name)
+            return candidate;
+        if (candidate.name < name)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return std::nullopt;
+}
+
+std::uint32_t module_interface::size() const noexcept {
+    return m_function_count;
+}
+
+llvm::StringRef module_interface::contents() const noexcept {
+    return m_buffer->getBuffer();
+}
+
+void write_module_interface(llvm::raw_ostream &out, const std::vector<const program*> &programs) {
+    // Sorted by name, for find()
+    std::map<std::string_view, const function*> exported;
+    for (const auto *p : programs)
+        for (const auto &fn : p->functions())
+            exported.emplace(fn->name(), fn.get());
+
+    std::string strings;
+    std::vector<std::array<std::uint32_t, 4>> offsets;
+    for (const auto &[name, fn] : exported) {
+        auto symbol = mangle(*fn);
+        offsets.push_back({static_cast<std::uint32_t>(strings.size()), static_cast<std::uint32_t>(name.size()),
+            static_cast<std::uint32_t>(strings.size() + name.size()), static_cast<std::uint32_t>(symbol.size())});
+        strings += name;
+        strings += symbol;
+    }
+    // Keeps the file a multiple of 4 bytes
+    strings.resize((strings.size() + 3) / 4 * 4, '\0');
+
+    out << interface_magic;
+    write32(out, interface_version);
+    write32(out, static_cast<std::uint32_t>(exported.size()));
+    write32(out, static_cast<std::uint32_t>(strings.size()));
+    std::size_t i = 0;
+    for (const auto &[name, fn] : exported) {
+        for (auto value : offsets[i++])
+            write32(out, value);
+        // Functions take no parameters yet
+        out << static_cast<char>(fn->return_type().id()) << '\0' << '\0' << '\0';
+    }
+    out << strings;
+}
+
+void symbol_table::import(const module_interface &interface) {
+    m_imports.push_back(&interface);
+}
+
+std::optional<function_signature> symbol_table::find(std::string_view name) const {
+    for (const auto *interface : m_imports)
+        if (auto signature = interface->find(name))
+            return signature;
+    return std::nullopt;
+}
+
+bool symbol_table::empty() const noexcept {
+    return m_imports.empty();
+}
+
+}
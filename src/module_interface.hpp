@@ -0,0 +1,65 @@
+#ifndef CANNON_MODULE_INTERFACE_HPP
+#define CANNON_MODULE_INTERFACE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "program.hpp"
+
+namespace cannon {
+
+// One exported function, as recorded in a module interface. The strings point into the interface.
+struct function_signature {
+    std::string_view name;
+    std::string_view symbol;
+    type_id return_type;
+    std::uint8_t parameter_count;
+};
+
+// A .tbd module interface: the exported signatures of a JoinedModule or SharedModule, written next
+// to its objects so that dependents can be checked and compiled against it without its sources.
+//
+// The file is used in place, straight from a mapping: a fixed header, a table of fixed-size
+// records sorted by name, then the names and symbols they point at. All integers are little-endian
+// and 32-bit aligned. Loading only validates the header and table bounds, and lookups are a binary
+// search, so importing a module costs in proportion to its interface, not its sources.
+class module_interface {
+  private:
+    std::unique_ptr<llvm::MemoryBuffer> m_buffer;
+    std::uint32_t m_function_count;
+
+    explicit module_interface(std::unique_ptr<llvm::MemoryBuffer> buffer, std::uint32_t function_count);
+    function_signature function_at(std::uint32_t index) const;
+  public:
+    // Reports and exits if `path` can't be read or isn't a module interface
+    static module_interface load(std::string_view path);
+
+    std::optional<function_signature> find(std::string_view name) const;
+    [[nodiscard]] std::uint32_t size() const noexcept;
+    // The raw file, for cache keys
+    [[nodiscard]] llvm::StringRef contents() const noexcept;
+};
+
+// Writes the interface exporting every function of `programs`; a name defined twice keeps its first
+void write_module_interface(llvm::raw_ostream &out, const std::vector<const program*> &programs);
+
+// The functions a file can call besides its own: those of the module interfaces it imports, with
+// earlier imports taking precedence
+class symbol_table {
+  private:
+    std::vector<const module_interface*> m_imports;
+  public:
+    void import(const module_interface &interface);
+    std::optional<function_signature> find(std::string_view name) const;
+    [[nodiscard]] bool empty() const noexcept;
+};
+
+}
+
+#endif // CANNON_MODULE_INTERFACE_HPP
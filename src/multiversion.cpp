@@ -0,0 +1,197 @@
+#include "multiversion.hpp"
+
+#include <algorithm>
+#include <map>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+struct cpu_level {
+    std::string_view cpu;
+    unsigned level;
+};
+
+static constexpr cpu_level cpu_levels[] = {{"x86-64-v2"sv, 2}, {"x86-64-v3"sv, 3}, {"x86-64-v4"sv, 4}};
+
+static unsigned level_of(std::string_view cpu) {
+    for (const auto &level : cpu_levels)
+        if (level.cpu == cpu)
+            return level.level;
+    return 0;
+}
+
+std::optional<std::vector<std::string>> parse_multiversion_cpus(std::string_view list) {
+    std::vector<std::string> cpus;
+    llvm::StringRef rest{list.data(), list.size()};
+    while (!rest.empty()) {
+        auto [cpu, tail] = rest.split(',');
+        if (!level_of(cpu))
+            return std::nullopt;
+        if (std::find(cpus.begin(), cpus.end(), cpu) == cpus.end())
+            cpus.push_back(cpu.str());
+        rest = tail;
+    }
+    if (cpus.empty())
+        return std::nullopt;
+    // The resolver tries them from the lowest level up, keeping the last one the machine has
+    std::sort(cpus.begin(), cpus.end(), [](const auto &a, const auto &b) { return level_of(a) < level_of(b); });
+    return cpus;
+}
+
+std::string multiversion_unsupported(const llvm::Triple &triple) {
+    if (triple.getArch() != llvm::Triple::x86_64)
+        return "-fmultiversion can only dispatch between x86-64 CPUs";
+    if (!triple.isOSBinFormatELF() || triple.isMusl())
+        return "-fmultiversion needs ifunc support, which " + triple.str() + " doesn't have";
+    return {};
+}
+
+// cpuid bits the levels need, as listed by the x86-64 psABI
+static constexpr std::uint32_t v2_leaf1_ecx = 1u << 0 | 1u << 9 | 1u << 13 | 1u << 19 | 1u << 20 | 1u << 23;
+static constexpr std::uint32_t v2_extended_ecx = 1u << 0;
+static constexpr std::uint32_t v3_leaf1_ecx = 1u << 12 | 1u << 22 | 1u << 27 | 1u << 28 | 1u << 29;
+static constexpr std::uint32_t v3_leaf7_ebx = 1u << 3 | 1u << 5 | 1u << 8;
+static constexpr std::uint32_t v3_extended_ecx = 1u << 5;
+static constexpr std::uint32_t v3_xcr0 = 0x6;
+static constexpr std::uint32_t v4_leaf7_ebx = 1u << 16 | 1u << 17 | 1u << 28 | 1u << 30 | 1u << 31;
+static constexpr std::uint32_t v4_xcr0 = 0xE6;
+
+// Builds `i32 cannon.cpu_level()`, the x86-64 level (1-4) of the machine it runs on. The AVX
+// levels also need the OS to save the wider registers, which only xgetbv can tell, and xgetbv
+// itself only exists when cpuid says OSXSAVE.
+static llvm::Function *cpu_level_function(llvm::Module &module) {
+    if (auto *existing = module.getFunction("cannon.cpu_level"))
+        return existing;
+    auto &context = module.getContext();
+    auto *i32 = llvm::Type::getInt32Ty(context);
+    auto *fn = llvm::Function::Create(llvm::FunctionType::get(i32, false), llvm::Function::InternalLinkage,
+        "cannon.cpu_level", module);
+    auto *entry = llvm::BasicBlock::Create(context, "entry", fn);
+    auto *leaf7 = llvm::BasicBlock::Create(context, "leaf7", fn);
+    auto *check_os = llvm::BasicBlock::Create(context, "check_os", fn);
+    auto *xgetbv = llvm::BasicBlock::Create(context, "xgetbv", fn);
+    auto *done = llvm::BasicBlock::Create(context, "done", fn);
+    llvm::IRBuilder<> builder{entry};
+
+    auto *cpuid_type = llvm::FunctionType::get(llvm::StructType::get(i32, i32, i32, i32), {i32, i32}, false);
+    auto *cpuid_asm = llvm::InlineAsm::get(cpuid_type, "cpuid", "={ax},={bx},={cx},={dx},{ax},{cx},~{dirflag},~{fpsr},~{flags}", true);
+    auto cpuid = [&](std::uint32_t leaf, unsigned reg) {
+        auto *regs = builder.CreateCall(cpuid_type, cpuid_asm, {builder.getInt32(leaf), builder.getInt32(0)});
+        return builder.CreateExtractValue(regs, reg);
+    };
+    auto has_all = [&](llvm::Value *value, std::uint32_t mask) {
+        return builder.CreateICmpEQ(builder.CreateAnd(value, mask), builder.getInt32(mask));
+    };
+
+    auto *max_leaf = cpuid(0, 0);
+    auto *leaf1_ecx = cpuid(1, 2);
+    auto *extended_ecx = cpuid(0x80000001, 2);
+    builder.CreateCondBr(builder.CreateICmpUGE(max_leaf, builder.getInt32(7)), leaf7, check_os);
+
+    builder.SetInsertPoint(leaf7);
+    auto *leaf7_ebx = cpuid(7, 1);
+    builder.CreateBr(check_os);
+
+    builder.SetInsertPoint(check_os);
+    auto *ebx = builder.CreatePHI(i32, 2);
+    ebx->addIncoming(builder.getInt32(0), entry);
+    ebx->addIncoming(leaf7_ebx, leaf7);
+    builder.CreateCondBr(has_all(leaf1_ecx, 1u << 27), xgetbv, done);
+
+    builder.SetInsertPoint(xgetbv);
+    auto *xgetbv_type = llvm::FunctionType::get(llvm::StructType::get(i32, i32), {i32}, false);
+    auto *xgetbv_asm = llvm::InlineAsm::get(xgetbv_type, "xgetbv", "={ax},={dx},{cx},~{dirflag},~{fpsr},~{flags}", true);
+    auto *xcr0_value = builder.CreateExtractValue(builder.CreateCall(xgetbv_type, xgetbv_asm, {builder.getInt32(0)}), 0);
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    auto *xcr0 = builder.CreatePHI(i32, 2);
+    xcr0->addIncoming(builder.getInt32(0), check_os);
+    xcr0->addIncoming(xcr0_value, xgetbv);
+    auto *v2 = builder.CreateAnd(has_all(leaf1_ecx, v2_leaf1_ecx), has_all(extended_ecx, v2_extended_ecx));
+    auto *v3 = builder.CreateAnd({v2, has_all(leaf1_ecx, v3_leaf1_ecx), has_all(ebx, v3_leaf7_ebx),
+        has_all(extended_ecx, v3_extended_ecx), has_all(xcr0, v3_xcr0)});
+    auto *v4 = builder.CreateAnd({v3, has_all(ebx, v4_leaf7_ebx), has_all(xcr0, v4_xcr0)});
+    llvm::Value *level = builder.getInt32(1);
+    level = builder.CreateSelect(v2, builder.getInt32(2), level);
+    level = builder.CreateSelect(v3, builder.getInt32(3), level);
+    level = builder.CreateSelect(v4, builder.getInt32(4), level);
+    builder.CreateRet(level);
+    return fn;
+}
+
+multiversion_pass::multiversion_pass(std::vector<std::string> cpus) : m_cpus(std::move(cpus)) {}
+
+llvm::PreservedAnalyses multiversion_pass::run(llvm::Module &module, llvm::ModuleAnalysisManager &analyses) {
+    auto &profile = analyses.getResult<llvm::ProfileSummaryAnalysis>(module);
+    std::vector<llvm::Function*> hot;
+    for (auto &fn : module) {
+        if (fn.isDeclaration() || !fn.hasExternalLinkage() || fn.getName() == "main")
+            continue;
+        if (profile.hasProfileSummary() && !profile.isFunctionEntryHot(&fn))
+            continue;
+        hot.push_back(&fn);
+    }
+    if (hot.empty())
+        return llvm::PreservedAnalyses::all();
+
+    auto *level = cpu_level_function(module);
+    // Every version of each ifunc, the original first and then one per m_cpus
+    std::map<llvm::Value*, std::vector<llvm::Function*>> versions;
+    for (auto *fn : hot) {
+        std::vector<llvm::Function*> copies{fn};
+        for (const auto &cpu : m_cpus) {
+            llvm::ValueToValueMapTy map;
+            auto *copy = llvm::CloneFunction(fn, map);
+            copy->setName(fn->getName() + "." + cpu);
+            copy->setLinkage(llvm::Function::InternalLinkage);
+            copy->addFnAttr("target-cpu", cpu);
+            copies.push_back(copy);
+        }
+
+        auto *resolver = llvm::Function::Create(llvm::FunctionType::get(fn->getType(), false),
+            llvm::Function::InternalLinkage, fn->getName() + ".resolver", module);
+        auto *ifunc = llvm::GlobalIFunc::create(fn->getValueType(), fn->getAddressSpace(), llvm::Function::ExternalLinkage,
+            "", resolver, &module);
+        fn->replaceAllUsesWith(ifunc);
+        ifunc->takeName(fn);
+        fn->setName(ifunc->getName() + ".default");
+        fn->setLinkage(llvm::Function::InternalLinkage);
+
+        llvm::IRBuilder<> builder{llvm::BasicBlock::Create(module.getContext(), "entry", resolver)};
+        auto *machine_level = builder.CreateCall(level);
+        llvm::Value *chosen = fn;
+        for (std::size_t i = 0; i < m_cpus.size(); i++)
+            chosen = builder.CreateSelect(builder.CreateICmpUGE(machine_level, builder.getInt32(level_of(m_cpus[i]))),
+                copies[i + 1], chosen);
+        builder.CreateRet(chosen);
+        versions.emplace(ifunc, std::move(copies));
+    }
+
+    // Every hot function has the same versions, so a version only ever runs on machines where the
+    // resolver would pick the same version of its callees; calling them directly skips the PLT
+    for (const auto &[ifunc, copies] : versions) {
+        for (std::size_t i = 0; i < copies.size(); i++) {
+            for (auto &instruction : llvm::instructions(*copies[i])) {
+                auto *call = llvm::dyn_cast<llvm::CallBase>(&instruction);
+                if (!call)
+                    continue;
+                if (auto callee = versions.find(call->getCalledOperand()); callee != versions.end())
+                    call->setCalledFunction(callee->second[i]);
+            }
+        }
+    }
+    return llvm::PreservedAnalyses::none();
+}
+
+}
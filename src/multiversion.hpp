@@ -0,0 +1,38 @@
+#ifndef CANNON_MULTIVERSION_HPP
+#define CANNON_MULTIVERSION_HPP
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+
+namespace cannon {
+
+// The CPUs -fmultiversion can build extra versions of functions for. The dispatcher has to be
+// able to tell them apart at run time, so these are the x86-64 microarchitecture levels.
+std::optional<std::vector<std::string>> parse_multiversion_cpus(std::string_view list);
+
+// Why functions for `triple` can't be multiversioned, or empty if they can
+std::string multiversion_unsupported(const llvm::Triple &triple);
+
+// Gives each hot function a copy for every CPU in `cpus` besides its original, and turns the
+// function into an ifunc whose resolver picks the best copy for the machine it runs on. Without
+// profile data every function but main counts as hot. Runs between the simplification and
+// optimization pipelines, so that the copies share the profile and the inlining decisions, and
+// are then vectorized for their own CPU.
+class multiversion_pass : public llvm::PassInfoMixin<multiversion_pass> {
+  private:
+    std::vector<std::string> m_cpus;
+  public:
+    explicit multiversion_pass(std::vector<std::string> cpus);
+
+    llvm::PreservedAnalyses run(llvm::Module &module, llvm::ModuleAnalysisManager &analyses);
+};
+
+}
+
+#endif // CANNON_MULTIVERSION_HPP
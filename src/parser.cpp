@@ -1,19 +1,26 @@
 #include "parser.hpp"
 
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <string_view>
 
+#include <llvm/Support/TimeProfiler.h>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
 using namespace std::string_view_literals;
 
 namespace cannon {
 
-std::unique_ptr<expression_node> parse_expression(std::vector<token>::iterator &token_it); // Why are we using C++ again?
+std::unique_ptr<expression_node> parse_expression(std::vector<token>::iterator &token_it, const literal_table &literals); // Why are we using C++ again?
 
 [[noreturn]] void syntax_error(token cur_token, std::string expected) {
-    std::cerr << cur_token.get_line() << ":" << cur_token.get_column() << ": Syntax error: expected " << expected << ", got \"" << cur_token.get_text() << "\"" << std::endl;
-    std::exit(1);
+    report({diagnostic_level::Error, {}, 0, 0,
+        "Syntax error: expected " + expected + ", got \"" + std::string{cur_token.get_text()} + "\"", cur_token.get_location()});
+    throw compiler_exit{1};
 }
 
 void expect(std::vector<token>::iterator &token_it, std::string expected, std::string description) {
@@ -25,48 +32,45 @@ void expect(std::vector<token>::iterator &token_it, std::string expected, std::s
     }
 }
 
-std::unique_ptr<expression_node> parse_primary_expression(std::vector<token>::iterator &token_it) {
+// Gives `node` the location of `at`
+template <typename Node>
+std::unique_ptr<Node> located(std::unique_ptr<Node> node, const token &at) {
+    node->set_location(at.get_location());
+    return node;
+}
+
+std::unique_ptr<expression_node> parse_primary_expression(std::vector<token>::iterator &token_it, const literal_table &literals) {
+    token start = *token_it;
     token cur_token = *(token_it++);
     switch (cur_token.get_type()) {
       case NUMBER: {
-        int value = 0;
-        for (char c : cur_token.get_text()) {
-            // TODO: check for overflow
-            value *= 10;
-            value += (c - '0');
+        // The lexer decoded it; integer nodes only hold an i32 so far
+        uint128 value = literals.integers[cur_token.get_literal()];
+        if (value.high || value.low > static_cast<std::uint64_t>(std::numeric_limits<int>::max())) {
+            report({diagnostic_level::Error, {}, 0, 0,
+                "Integer literal " + std::string{cur_token.get_text()} + " doesn't fit in i32", cur_token.get_location()});
+            throw compiler_exit{1};
         }
         cur_token = *token_it;
         if (cur_token.get_text() == ".") {
             token_it++;
             token cur_token = *(token_it++);
-            switch (cur_token.get_type()) {
-              case NUMBER: {
-                double value2 = 0;
-                for (char c : cur_token.get_text()) {
-                    value2 += (c - '0');
-                    value2 /= 10;
-                }
-                cur_token = *token_it;
-                if (cur_token.get_text() == ".") {
-                    token_it++;
-                }
-                return std::make_unique<double_expression_node>(value+value2);
-              }
-              case IDENTIFIER:
-                std::cerr << "Calling functions on numbers is not implemented!" << std::endl;
-                std::exit(1);
-              default:
-                syntax_error(*token_it, "number or identifier");
+            if (cur_token.get_type() == IDENTIFIER) {
+                report({diagnostic_level::Error, {}, 0, 0,
+                    "Calling functions on numbers is not implemented!", cur_token.get_location()});
+                throw compiler_exit{1};
             }
-        } else {
-            return std::make_unique<integer_expression_node>(value);
+            syntax_error(cur_token, "identifier");
         }
+        return located(std::make_unique<integer_expression_node>(static_cast<int>(value.low)), start);
       }
+      case FLOAT:
+        return located(std::make_unique<double_expression_node>(literals.floats[cur_token.get_literal()]), start);
       case IDENTIFIER:
-        return std::make_unique<identifier_expression_node>(std::make_unique<identifier_node>(cur_token.get_text()));
+        return located(std::make_unique<identifier_expression_node>(located(std::make_unique<identifier_node>(cur_token.get_text_id()), cur_token)), cur_token);
       default:
         if (cur_token.get_text() == "(") { // parenthesised expression
-            auto result = parse_expression(token_it);
+            auto result = parse_expression(token_it, literals);
             expect(token_it, ")", "closing parenthesis");
             return result;
         }
@@ -74,60 +78,60 @@ std::unique_ptr<expression_node> parse_primary_expression(std::vector<token>::it
     }
 }
 
-std::map<std::string_view, std::pair<binary_operator, std::pair<uint8_t, uint8_t>>> operators {
+const std::map<std::string_view, std::pair<binary_operator, std::pair<uint8_t, uint8_t>>> operators {
     {"+"sv, {ADD, {1, 2}}},
     {"-"sv, {SUB, {1, 2}}},
     {"*"sv, {MUL, {3, 4}}},
     {"/"sv, {DIV, {3, 4}}},
 };
 
-std::unique_ptr<expression_node> parse_expression_bp(uint8_t min_bp, std::vector<token>::iterator &token_it) {
+std::unique_ptr<expression_node> parse_expression_bp(uint8_t min_bp, std::vector<token>::iterator &token_it, const literal_table &literals) {
     // pratt parser
     // see https://matklad.github.io/2020/04/13/simple-but-powerful-pratt-parsing.html
 
-    auto lhs = parse_primary_expression(token_it);
+    auto lhs = parse_primary_expression(token_it, literals);
 
     while (true) {
         token lookahead = (*token_it);
         if (lookahead.get_text() == "(") { // function call
+            token open = lookahead;
             token_it++; // skip "("
             std::vector<std::unique_ptr<expression_node>> params;
             lookahead = *token_it;
             while (lookahead.get_text() != ")") { // good ol' for abuse
-                params.push_back(parse_expression(token_it));
+                params.push_back(parse_expression(token_it, literals));
                 lookahead = *token_it;
-                std::cout << "parsed expression, now at " << lookahead.get_line() << ":" << lookahead.get_column() << " '" << lookahead.get_text() << "'" << std::endl;
                 if (lookahead.get_text() == ")") break;
                 expect(token_it, ",", "comma");
                 lookahead = *token_it;
-                std::cout << "parsed comma, now at " << lookahead.get_line() << ":" << lookahead.get_column() << " '" << lookahead.get_text() << "'" << std::endl;
             }
             token_it++; // skip ")"
-            lhs = std::make_unique<function_call_expression_node>(std::move(lhs), std::move(params));
+            lhs = located(std::make_unique<function_call_expression_node>(std::move(lhs), std::move(params)), open);
         } else {
             if (!operators.contains(lookahead.get_text())) break;
-            auto op = operators[lookahead.get_text()];
+            auto op = operators.at(lookahead.get_text());
             uint8_t l_bp = op.second.first;
             uint8_t r_bp = op.second.second;
             if (l_bp < min_bp) break;
             token_it++; // skip operator
-            auto rhs = parse_expression_bp(r_bp, token_it);
-            lhs = std::make_unique<binary_expression_node>(std::move(lhs), op.first, std::move(rhs));
+            auto rhs = parse_expression_bp(r_bp, token_it, literals);
+            lhs = located(std::make_unique<binary_expression_node>(std::move(lhs), op.first, std::move(rhs)), lookahead);
         }
     }
 
     return lhs;
 }
 
-std::unique_ptr<expression_node> parse_expression(std::vector<token>::iterator &token_it) {
-    return parse_expression_bp(0, token_it);
+std::unique_ptr<expression_node> parse_expression(std::vector<token>::iterator &token_it, const literal_table &literals) {
+    return parse_expression_bp(0, token_it, literals);
 }
 
 identifier_node parse_identifier(std::vector<token>::iterator &token_it) {
     token cur_token = *token_it;
     if (cur_token.get_type() != IDENTIFIER)
         syntax_error(cur_token, "identifier");
-    identifier_node result(cur_token.get_text());
+    identifier_node result(cur_token.get_text_id());
+    result.set_location(cur_token.get_location());
     token_it++;
     return result;
 }
@@ -136,20 +140,21 @@ type_node parse_type(std::vector<token>::iterator &token_it) {
     return type_node(std::make_unique<identifier_node>(parse_identifier(token_it)));
 }
 
-block_expression_node parse_block_expression(std::vector<token>::iterator &token_it) {
+block_expression_node parse_block_expression(std::vector<token>::iterator &token_it, const literal_table &literals) {
     std::vector<std::unique_ptr<statement_node>> statements;
 
     expect(token_it, "{", "\"{\"");
     while ((*token_it).get_text() != "}") {
         // TODO: parse non-expression statements
-        statements.push_back(parse_expression(token_it));
+        statements.push_back(parse_expression(token_it, literals));
     }
     token_it++; // skip "}"
 
     return block_expression_node(std::move(statements));
 }
 
-fn_node parse_fn(std::vector<token>::iterator &token_it) {
+fn_node parse_fn(std::vector<token>::iterator &token_it, const literal_table &literals) {
+    source_location location = token_it->get_location();
     expect(token_it, "fn", "function");
 
     std::unique_ptr<identifier_node> name = std::make_unique<identifier_node>(parse_identifier(token_it));
@@ -169,18 +174,22 @@ fn_node parse_fn(std::vector<token>::iterator &token_it) {
         return_type = std::make_unique<type_node>(parse_type(token_it));
     }
 
-    auto code = std::make_unique<block_expression_node>(parse_block_expression(token_it));
+    auto code = std::make_unique<block_expression_node>(parse_block_expression(token_it, literals));
 
-    return fn_node(std::move(name), std::move(parameters), std::move(return_type), std::move(code));
+    fn_node result(std::move(name), std::move(parameters), std::move(return_type), std::move(code));
+    result.set_location(location);
+    return result;
 }
 
-file_node parse_file(std::vector<token> tokens) {
+file_node parse_file(lexed_file file) {
+    llvm::TimeTraceScope trace{"Parse"};
     std::vector<std::unique_ptr<item_node>> items;
 
+    auto &tokens = file.tokens;
     auto token_it = tokens.begin();
     while (token_it != tokens.end()) {
         if ((*token_it).get_text() == "fn") {
-            std::unique_ptr<item_node> item = std::make_unique<fn_node>(parse_fn(token_it));
+            std::unique_ptr<item_node> item = std::make_unique<fn_node>(parse_fn(token_it, file.literals));
             items.push_back(std::move(item));
         } else {
             syntax_error(*token_it, "function");
@@ -4,11 +4,11 @@
 #include <vector>
 
 #include "ast.hpp"
-#include "token.hpp"
+#include "lex.hpp"
 
 namespace cannon {
 
-file_node parse_file(std::vector<token> tokens);
+file_node parse_file(lexed_file file);
 
 }
 
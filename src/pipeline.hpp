@@ -0,0 +1,148 @@
+#ifndef CANNON_PIPELINE_HPP
+#define CANNON_PIPELINE_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "time_trace.hpp"
+
+namespace cannon {
+
+// What -j defaults to: a thread per hardware thread
+inline unsigned default_jobs() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// The items waiting for one pipeline stage, with a deque for each of the stage's threads. Pushes deal
+// items out to the deques in turn. A thread takes the oldest item of its own deque, and once that is
+// empty steals the newest from another thread's, so none sits idle while another has a backlog
+// behind a large file. Pushing blocks while the stage holds `capacity` items, which holds back the
+// stages before it, so only a bounded number of items are in flight between any two stages.
+template <typename T>
+class work_stealing_queue {
+  private:
+    struct worker_deque {
+        std::mutex mutex;
+        std::deque<T> items;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::deque<worker_deque> m_deques;
+    std::size_t m_capacity;
+    std::size_t m_size{0}; // items in the deques that no pop has claimed yet
+    std::size_t m_next{0}; // the deque the next push goes to
+    bool m_closed{false};
+
+    std::optional<T> take(worker_deque &deque, bool oldest) {
+        std::lock_guard lock{deque.mutex};
+        if (deque.items.empty())
+            return std::nullopt;
+        T item = std::move(oldest ? deque.items.front() : deque.items.back());
+        if (oldest)
+            deque.items.pop_front();
+        else
+            deque.items.pop_back();
+        return item;
+    }
+  public:
+    work_stealing_queue(unsigned workers, std::size_t capacity)
+        : m_deques(std::max(1u, workers)), m_capacity(capacity ? capacity : 1) {}
+
+    void push(T item) {
+        std::unique_lock lock{m_mutex};
+        m_not_full.wait(lock, [this] { return m_size < m_capacity; });
+        {
+            auto &deque = m_deques[m_next];
+            std::lock_guard deque_lock{deque.mutex};
+            deque.items.push_back(std::move(item));
+        }
+        m_next = (m_next + 1) % m_deques.size();
+        m_size++;
+        m_not_empty.notify_one();
+    }
+
+    // The next item for thread `worker`; nothing once the queue is closed and drained
+    std::optional<T> pop(unsigned worker) {
+        {
+            std::unique_lock lock{m_mutex};
+            m_not_empty.wait(lock, [this] { return m_size > 0 || m_closed; });
+            if (m_size == 0)
+                return std::nullopt;
+            // Claimed, so one of the deques holds an item for this thread
+            m_size--;
+            m_not_full.notify_one();
+        }
+        for (;;) {
+            if (auto item = take(m_deques[worker], true))
+                return item;
+            for (std::size_t i = 1; i < m_deques.size(); i++) {
+                if (auto item = take(m_deques[(worker + i) % m_deques.size()], false))
+                    return item;
+            }
+        }
+    }
+
+    // No more items will be pushed
+    void close() {
+        std::lock_guard lock{m_mutex};
+        m_closed = true;
+        m_not_empty.notify_all();
+    }
+};
+
+template <typename T>
+struct pipeline_stage {
+    std::string name;
+    unsigned threads{1};
+    std::function<void(T &)> run; // must not throw
+};
+
+// Passes every item through each stage in turn. Every stage has its own threads, which share its
+// items by work stealing, so different items are in different stages at once; items may leave a
+// stage with several threads out of order. `queue_capacity` bounds the items waiting between two
+// stages.
+template <typename T>
+void run_pipeline(std::vector<T> &items, const std::vector<pipeline_stage<T>> &stages, std::size_t queue_capacity) {
+    if (stages.empty())
+        return;
+    std::deque<work_stealing_queue<T *>> queues;
+    for (const auto &stage : stages)
+        queues.emplace_back(stage.threads, queue_capacity);
+
+    std::vector<std::vector<std::thread>> threads(stages.size());
+    for (std::size_t stage = 0; stage < stages.size(); stage++) {
+        for (unsigned i = 0; i < std::max(1u, stages[stage].threads); i++) {
+            threads[stage].emplace_back([&, stage, i] {
+                time_trace_thread trace;
+                while (auto item = queues[stage].pop(i)) {
+                    stages[stage].run(**item);
+                    if (stage + 1 < stages.size())
+                        queues[stage + 1].push(*item);
+                }
+            });
+        }
+    }
+
+    for (auto &item : items)
+        queues.front().push(&item);
+    // A stage is finished once all of its threads are, and then the next one can drain and finish
+    for (std::size_t stage = 0; stage < stages.size(); stage++) {
+        queues[stage].close();
+        for (auto &thread : threads[stage])
+            thread.join();
+    }
+}
+
+}
+
+#endif // CANNON_PIPELINE_HPP
@@ -8,23 +8,33 @@ statement::~statement() {}
 
 expression::~expression() {}
 
-identifier_expression::identifier_expression(std::string value): m_value(value) {}
+identifier_expression::identifier_expression(name_id value, std::string symbol): m_value(value), m_symbol(symbol) {}
 
-void identifier_expression::do_print(std::ostream &os, std::string leftpad) {
-    os << "Identifier (" << m_value << ")";
+void identifier_expression::do_print(std::ostream &os, std::string leftpad) const {
+    os << "Identifier (" << value() << ")";
+    if (!m_symbol.empty())
+        os << " as " << m_symbol;
 }
 
-std::string identifier_expression::value() const {
+name_id identifier_expression::id() const {
     return m_value;
 }
 
+std::string_view identifier_expression::value() const {
+    return interned_names().text(m_value);
+}
+
+const std::string& identifier_expression::symbol() const {
+    return m_symbol;
+}
+
 type identifier_expression::return_type() const {
     return type(type_id::I32);
 }
 
 integer_expression::integer_expression(int value): m_value(value) {}
 
-void integer_expression::do_print(std::ostream &os, std::string leftpad) {
+void integer_expression::do_print(std::ostream &os, std::string leftpad) const {
     os << "Integer (" << m_value << ")";
 }
 
@@ -39,7 +49,7 @@ type integer_expression::return_type() const {
 binary_expression::binary_expression(std::unique_ptr<expression> lhs, binary_operator op, std::unique_ptr<expression> rhs, type return_type):
     m_lhs(std::move(lhs)), m_op(op), m_rhs(std::move(rhs)), m_return_type(return_type) {}
 
-void binary_expression::do_print(std::ostream &os, std::string leftpad) {
+void binary_expression::do_print(std::ostream &os, std::string leftpad) const {
     os << "Binary expression" << std::endl << leftpad;
 
     os << "LHS: ";
@@ -89,6 +99,23 @@ type binary_expression::return_type() const {
     return m_return_type;
 }
 
+reuse_expression::reuse_expression(const expression &original): m_original(&original) {}
+
+const expression& reuse_expression::original() const {
+    return *m_original;
+}
+
+type reuse_expression::return_type() const {
+    return m_original->return_type();
+}
+
+void reuse_expression::do_print(std::ostream &os, std::string leftpad) const {
+    // What's reused, so that functions differing in it print differently
+    os << "Reused expression" << std::endl << leftpad;
+    os << "Of: ";
+    m_original->do_print(os, leftpad + "  ");
+}
+
 function_call_expression::function_call_expression(std::unique_ptr<expression> func, std::vector<std::unique_ptr<expression>> params):
     m_func(std::move(func)), m_params(std::move(params)) {}
 
@@ -100,7 +127,7 @@ const std::vector<std::unique_ptr<expression>>& function_call_expression::params
     return m_params;
 }
 
-void function_call_expression::do_print(std::ostream &os, std::string leftpad) {
+void function_call_expression::do_print(std::ostream &os, std::string leftpad) const {
     os << "Function call expression" << std::endl << leftpad;
 
     os << "Function: ";
@@ -120,12 +147,16 @@ type function_call_expression::return_type() const {
     return type(type_id::I32);
 }
 
-void incomplete_identifier_expression::set_value(std::string value) {
+void incomplete_identifier_expression::set_value(name_id value) {
     m_value = value;
 }
 
+void incomplete_identifier_expression::set_symbol(std::string symbol) {
+    m_symbol = symbol;
+}
+
 identifier_expression incomplete_identifier_expression::to_identifier_expression() const {
-    return identifier_expression(m_value);
+    return identifier_expression(m_value, m_symbol);
 }
 
 std::unique_ptr<expression> incomplete_identifier_expression::to_expression_ptr() const {
@@ -248,12 +279,26 @@ const std::vector<std::unique_ptr<incomplete_function>>& incomplete_program::fun
     return m_functions;
 }
 
+void incomplete_program::set_calls(call_graph calls) {
+    m_calls = std::move(calls);
+}
+
+void incomplete_program::retain(const std::vector<bool> &keep) {
+    std::vector<std::unique_ptr<incomplete_function>> kept;
+    for(std::size_t i = 0; i < m_functions.size(); i++) {
+        if(keep[i])
+            kept.push_back(std::move(m_functions[i]));
+    }
+    m_functions = std::move(kept);
+    m_calls = m_calls.subgraph(keep);
+}
+
 program incomplete_program::to_program() const {
     std::vector<std::unique_ptr<function>> functions;
     for(auto &f : m_functions) {
         functions.push_back(f->to_function_ptr());
     }
-    return program(std::move(functions));
+    return program(std::move(functions), m_calls);
 }
 
 type::type(type_id id): m_id(id) {}
@@ -285,6 +330,10 @@ const std::vector<std::unique_ptr<statement>>& function::statements() const {
     return m_statements;
 }
 
+void function::set_statements(std::vector<std::unique_ptr<statement>> statements) {
+    m_statements = std::move(statements);
+}
+
 std::ostream& operator<<(std::ostream &os, const function &function) {
     os << "    Function" << std::endl;
     os << "      Name: " << function.name() << std::endl;
@@ -305,7 +354,15 @@ const std::string& function::name() const {
     return m_name;
 }
 
-program::program(std::vector<std::unique_ptr<function>> functions): m_functions(std::move(functions)) {}
+std::string mangle(const function &fn) {
+    std::string result = "_C";
+    result += std::to_string(fn.name().size());
+    result += fn.name();
+    result += "v"; // All functions have no parameters; don't ask too many questions.
+    return result;
+}
+
+program::program(std::vector<std::unique_ptr<function>> functions, call_graph calls): m_functions(std::move(functions)), m_calls(std::move(calls)) {}
 
 std::ostream& operator<<(std::ostream &os, const program &program) {
     os << "Program" << std::endl << "  Functions:";
@@ -319,4 +376,12 @@ const std::vector<std::unique_ptr<function>>& program::functions() const {
     return m_functions;
 }
 
+const call_graph& program::calls() const {
+    return m_calls;
+}
+
+void program::set_calls(call_graph calls) {
+    m_calls = std::move(calls);
+}
+
 }
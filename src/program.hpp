@@ -7,6 +7,8 @@
 #include <vector>
 
 #include "ast.hpp"
+#include "call_graph.hpp"
+#include "interner.hpp"
 
 namespace cannon {
 
@@ -29,7 +31,7 @@ class statement {
   public:
     virtual ~statement() = 0;
     virtual type return_type() const = 0;
-    virtual void do_print(std::ostream &os, std::string leftpad) = 0;
+    virtual void do_print(std::ostream &os, std::string leftpad) const = 0;
 };
 
 class expression : public statement {
@@ -49,17 +51,20 @@ class binary_expression : public expression {
     const expression& rhs() const;
     binary_operator op() const;
     type return_type() const;
-    void do_print(std::ostream &os, std::string leftpad);
+    void do_print(std::ostream &os, std::string leftpad) const;
 };
 
 class identifier_expression : public expression {
   private:
-    std::string m_value;
+    name_id m_value;
+    std::string m_symbol; // Set when an imported module interface declared it
   public:
-    identifier_expression(std::string value);
-    std::string value() const;
+    identifier_expression(name_id value, std::string symbol = {});
+    name_id id() const;
+    std::string_view value() const;
+    const std::string& symbol() const;
     type return_type() const;
-    void do_print(std::ostream &os, std::string leftpad);
+    void do_print(std::ostream &os, std::string leftpad) const;
 };
 
 class integer_expression : public expression {
@@ -69,7 +74,19 @@ class integer_expression : public expression {
     integer_expression(int value);
     int value() const;
     type return_type() const;
-    void do_print(std::ostream &os, std::string leftpad);
+    void do_print(std::ostream &os, std::string leftpad) const;
+};
+
+// The value of an identical expression evaluated earlier in the same function, which CSE left in
+// place of a repeat of it
+class reuse_expression : public expression {
+  private:
+    const expression *m_original;
+  public:
+    explicit reuse_expression(const expression &original);
+    const expression& original() const;
+    type return_type() const;
+    void do_print(std::ostream &os, std::string leftpad) const;
 };
 
 class function_call_expression : public expression {
@@ -80,7 +97,7 @@ class function_call_expression : public expression {
     function_call_expression(std::unique_ptr<expression> func, std::vector<std::unique_ptr<expression>> params);
     const expression& func() const;
     const std::vector<std::unique_ptr<expression>>& params() const;
-    void do_print(std::ostream &os, std::string leftpad);
+    void do_print(std::ostream &os, std::string leftpad) const;
     type return_type() const;
 };
 
@@ -95,15 +112,22 @@ class function {
     type return_type() const;
     const std::string& name() const;
     const std::vector<std::unique_ptr<statement>>& statements() const;
+    void set_statements(std::vector<std::unique_ptr<statement>> statements);
 };
 
+// The symbol `fn` is emitted as
+std::string mangle(const function &fn);
+
 class program {
   private:
     std::vector<std::unique_ptr<function>> m_functions;
+    call_graph m_calls;
   public:
-    program(std::vector<std::unique_ptr<function>> functions);
+    program(std::vector<std::unique_ptr<function>> functions, call_graph calls);
     friend std::ostream &operator<<(std::ostream &os, const program &program);
     const std::vector<std::unique_ptr<function>>& functions() const;
+    const call_graph& calls() const;
+    void set_calls(call_graph calls);
 };
 
 class incomplete_type {
@@ -133,11 +157,13 @@ class incomplete_expression : public incomplete_statement {
 
 class incomplete_identifier_expression : public incomplete_expression {
   private:
-    std::string m_value;
+    name_id m_value;
+    std::string m_symbol;
   public:
     std::unique_ptr<expression> to_expression_ptr() const;
     identifier_expression to_identifier_expression() const;
-    void set_value(std::string value);
+    void set_value(name_id value);
+    void set_symbol(std::string symbol);
 };
 
 class incomplete_integer_expression : public incomplete_expression {
@@ -196,10 +222,14 @@ class incomplete_function {
 class incomplete_program {
   private:
     std::vector<std::unique_ptr<incomplete_function>> m_functions;
+    call_graph m_calls;
   public:
     program to_program() const;
     void add_function(std::unique_ptr<incomplete_function> function);
     const std::vector<std::unique_ptr<incomplete_function>>& functions() const;
+    void set_calls(call_graph calls);
+    // Drops the functions `keep` doesn't select, along with their nodes in the call graph
+    void retain(const std::vector<bool> &keep);
 };
 
 }
@@ -1,18 +1,48 @@
 #include "semantic.hpp"
 
-#include <cstdlib>
+#include <cstdint>
 #include <iostream>
 #include <unordered_map>
+#include <vector>
+
+#include <llvm/Support/TimeProfiler.h>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
 
 namespace cannon {
 
-std::unique_ptr<incomplete_expression> convert_and_tag_expr(const expression_node &expr) {
+// What a file can call: its own functions, then those of its imports. Calls to its own functions
+// are collected in `calls`, for the call graph.
+struct name_scope {
+    const std::unordered_map<std::string_view, std::uint32_t> &local;
+    const symbol_table &imports;
+    std::vector<std::uint32_t> &calls;
+};
+
+static void resolve_call(incomplete_identifier_expression &callee, const identifier_expression_node &name_node, const name_scope &scope) {
+    const identifier_node &identifier = name_node.get_value();
+    std::string_view name = identifier.get_value();
+    if (auto local = scope.local.find(name); local != scope.local.end()) {
+        scope.calls.push_back(local->second);
+        return;
+    }
+    if (auto signature = scope.imports.find(name)) {
+        callee.set_symbol(std::string{signature->symbol});
+    } else if (!scope.imports.empty()) {
+        // At the name itself, which is where the parser put it, whatever the call around it spans
+        report({diagnostic_level::Warning, {}, 0, 0,
+            "\"" + std::string{name} + "\" is not defined here or in an imported module; leaving it to the linker", identifier.get_location()});
+    }
+}
+
+std::unique_ptr<incomplete_expression> convert_and_tag_expr(const expression_node &expr, const name_scope &scope) {
     const binary_expression_node *bin_expr = dynamic_cast<const binary_expression_node*>(&expr);
     if(bin_expr) {
         incomplete_binary_expression result;
-        result.set_lhs(convert_and_tag_expr(bin_expr->get_lhs()));
+        result.set_lhs(convert_and_tag_expr(bin_expr->get_lhs(), scope));
         result.set_op(bin_expr->get_op());
-        result.set_rhs(convert_and_tag_expr(bin_expr->get_rhs()));
+        result.set_rhs(convert_and_tag_expr(bin_expr->get_rhs(), scope));
         incomplete_type t;
         t.set_id(type_id::I32);
         result.set_return_type(t);
@@ -27,57 +57,131 @@ std::unique_ptr<incomplete_expression> convert_and_tag_expr(const expression_nod
     const identifier_expression_node *id_expr = dynamic_cast<const identifier_expression_node*>(&expr);
     if(id_expr) {
         incomplete_identifier_expression result;
-        result.set_value(id_expr->get_value().get_value());
+        result.set_value(id_expr->get_value().get_id());
         return std::make_unique<incomplete_identifier_expression>(result);
     }
     const function_call_expression_node *fn_expr = dynamic_cast<const function_call_expression_node*>(&expr);
     if(fn_expr) {
         incomplete_function_call_expression result;
-        result.set_func(convert_and_tag_expr(fn_expr->get_func()));
+        auto callee = convert_and_tag_expr(fn_expr->get_func(), scope);
+        if (auto id_callee = dynamic_cast<const identifier_expression_node*>(&fn_expr->get_func()))
+            resolve_call(static_cast<incomplete_identifier_expression&>(*callee), *id_callee, scope);
+        result.set_func(std::move(callee));
         for(const auto &param : fn_expr->get_params()) {
-            result.add_param(convert_and_tag_expr(*param));
+            result.add_param(convert_and_tag_expr(*param, scope));
         }
         return std::make_unique<incomplete_function_call_expression>(std::move(result));
     }
-    std::abort();
+    report({diagnostic_level::Error, {}, 0, 0, std::string{expr.get_node_name()} + " is not supported yet"});
+    throw compiler_exit{1};
+}
+
+// Lists `func` in `result`, with its return type left for type resolution
+static incomplete_function &list_function(incomplete_program &result, const fn_node &func,
+        std::unordered_map<std::string_view, incomplete_type> &incomp_types) {
+    incomplete_function result_fn;
+    result_fn.set_name(func.get_name().get_value());
+    std::string_view return_type_name = func.get_return_type()->get_name().get_value();
+    if(!incomp_types.contains(return_type_name)) {
+        incomplete_type t;
+        t.set_name(return_type_name);
+        incomp_types[return_type_name] = t;
+    }
+    result_fn.set_return_type(incomp_types[return_type_name]);
+    result_fn.set_ast(func);
+    result.add_function(std::make_unique<incomplete_function>(std::move(result_fn)));
+    return *result.functions().back();
+}
+
+static void tag_function(incomplete_function &fn, const name_scope &scope) {
+    const std::vector<std::unique_ptr<statement_node>> &statements = fn.ast().get_code().get_statements();
+    for(auto statement = statements.begin(); statement < statements.end(); statement++) {
+        const expression_node *expr = dynamic_cast<const expression_node*>(&(**statement));
+        std::unique_ptr<incomplete_expression> result_expr = convert_and_tag_expr(*expr, scope);
+        fn.add_statement(std::move(result_expr));
+    }
+}
+
+static void resolve_types(std::unordered_map<std::string_view, incomplete_type> &incomp_types) {
+    llvm::TimeTraceScope pass_trace{"Type resolution"};
+    for(auto &[name, type] : incomp_types) {
+        if(name == "i32") {
+            type.set_id(type_id::I32);
+        } else {
+            report({diagnostic_level::Error, {}, 0, 0, "I don't recognize \"" + std::string{name} + "\" as a type!"});
+        }
+    }
 }
 
-program analyze(file_node file) {
+program analyze(file_node file, const symbol_table &imports, const std::vector<std::string> *roots) {
+    llvm::TimeTraceScope trace{"Analyze"};
     incomplete_program result;
     std::unordered_map<std::string_view, incomplete_type> incomp_types;
+    std::unordered_map<std::string_view, std::uint32_t> local_functions;
     // FUNCTION LISTING
-    for(const auto &item : file.get_items()) {
-        const fn_node *func = dynamic_cast<const fn_node*>(&(*item));
-        incomplete_function result_fn;
-        result_fn.set_name(func->get_name().get_value());
-        std::string_view return_type_name = func->get_return_type()->get_name().get_value();
-        if(!incomp_types.contains(return_type_name)) {
-            incomplete_type t;
-            t.set_name(return_type_name);
-            incomp_types[return_type_name] = t;
+    {
+        llvm::TimeTraceScope pass_trace{"Function listing"};
+        for(const auto &item : file.get_items()) {
+            const fn_node *func = dynamic_cast<const fn_node*>(&(*item));
+            local_functions.emplace(func->get_name().get_value(), static_cast<std::uint32_t>(result.functions().size()));
+            list_function(result, *func, incomp_types);
         }
-        result_fn.set_return_type(incomp_types[return_type_name]);
-        result_fn.set_ast(*func);
-        result.add_function(std::make_unique<incomplete_function>(std::move(result_fn)));
     }
     // EXPRESSION TAGGING
-    for(auto &fn : result.functions()) {
-        const fn_node &func = fn->ast();
-        const std::vector<std::unique_ptr<statement_node>> &statements = func.get_code().get_statements();
-        for(auto statement = statements.begin(); statement < statements.end(); statement++) {
-            const expression_node *expr = dynamic_cast<const expression_node*>(&(**statement));
-            std::unique_ptr<incomplete_expression> result_expr = convert_and_tag_expr(*expr);
-            fn->add_statement(std::move(result_expr));
+    // Functions are tagged as calls reach them, building the call graph on the way
+    std::vector<bool> tagged(result.functions().size());
+    {
+        llvm::TimeTraceScope pass_trace{"Expression tagging"};
+        call_graph calls{result.functions().size()};
+        std::vector<std::uint32_t> pending;
+        if(roots) {
+            for(const auto &root : *roots) {
+                if(auto local = local_functions.find(root); local != local_functions.end())
+                    pending.push_back(local->second);
+            }
+        } else {
+            for(auto i = static_cast<std::uint32_t>(result.functions().size()); i-- > 0;)
+                pending.push_back(i);
+        }
+        while(!pending.empty()) {
+            std::uint32_t index = pending.back();
+            pending.pop_back();
+            if(tagged[index])
+                continue;
+            tagged[index] = true;
+            std::vector<std::uint32_t> callees;
+            tag_function(*result.functions()[index], name_scope{local_functions, imports, callees});
+            for(auto callee : callees) {
+                calls.add_call(index, callee);
+                pending.push_back(callee);
+            }
         }
+        result.set_calls(std::move(calls));
     }
     // TYPE RESOLUTION
-    for(auto &[name, type] : incomp_types) {
-        if(name == "i32") {
-            type.set_id(type_id::I32);
-        } else {
-            std::cerr << "I don't recognize \"" << name << "\" as a type!" << std::endl;
-        }
+    resolve_types(incomp_types);
+    if(roots)
+        result.retain(tagged);
+    return result.to_program();
+}
+
+program analyze_item(const fn_node &item, const std::unordered_map<std::string_view, std::uint32_t> &file_functions,
+        const symbol_table &imports) {
+    llvm::TimeTraceScope trace{"Analyze item", item.get_name().get_value()};
+    incomplete_program result;
+    std::unordered_map<std::string_view, incomplete_type> incomp_types;
+    auto &fn = list_function(result, item, incomp_types);
+    std::vector<std::uint32_t> callees;
+    tag_function(fn, name_scope{file_functions, imports, callees});
+    // Calls to the file's other functions leave this program, so the only edge it can have is to itself
+    call_graph calls{1};
+    auto self = file_functions.find(item.get_name().get_value());
+    for(auto callee : callees) {
+        if(self != file_functions.end() && callee == self->second)
+            calls.add_call(0, 0);
     }
+    result.set_calls(std::move(calls));
+    resolve_types(incomp_types);
     return result.to_program();
 }
 
@@ -1,11 +1,27 @@
 #ifndef CANNON_SEMANTIC_HPP
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 #include "ast.hpp"
+#include "module_interface.hpp"
 #include "program.hpp"
 
 namespace cannon {
 
-program analyze(file_node);
+// Calls to functions the file doesn't define are resolved against `imports`. The call graph between
+// the file's own functions is kept with the program. With `roots`, only the functions they reach
+// are analysed and kept; the rest just have their signatures checked.
+program analyze(file_node, const symbol_table &imports = symbol_table{}, const std::vector<std::string> *roots = nullptr);
+
+// Analyses one function of a file that is compiled an item at a time. `file_functions` numbers
+// every function of the file by name, so calls resolve as they would in analyze(); calls to the
+// others are left to the symbols their own items define.
+program analyze_item(const fn_node &item, const std::unordered_map<std::string_view, std::uint32_t> &file_functions,
+    const symbol_table &imports = symbol_table{});
 
 }
 
@@ -0,0 +1,281 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "diagnostics.hpp"
+#include "driver.hpp"
+#include "target.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+// Requests are a header, carrying the client's stdin, stdout and stderr as SCM_RIGHTS, followed by
+// the payload: the client's working directory and then its arguments, each as a length-prefixed
+// string. The reply is the exit status.
+static constexpr char request_magic[4] = {'C', 'N', 'N', '1'};
+static constexpr std::size_t max_payload = 1 << 24;
+static constexpr std::size_t max_programs = 4096;
+
+struct request_header {
+    char magic[4];
+    std::uint32_t payload_size;
+};
+
+std::string default_server_socket() {
+    if (const char *runtime_dir = std::getenv("XDG_RUNTIME_DIR"))
+        return (std::filesystem::path{runtime_dir} / "cannon-bootstrap.sock").string();
+    return "/tmp/cannon-bootstrap-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool fill_address(sockaddr_un &address, const std::string &socket_path) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        report({diagnostic_level::Error, {}, 0, 0, "Socket path " + socket_path + " is too long"});
+        return false;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    return true;
+}
+
+// Whoever connects runs compiles with the server's rights, and hands it their terminal, so both
+// ends only talk to processes of the same user
+static bool same_user(int fd) {
+    ucred peer;
+    socklen_t size = sizeof(peer);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == getuid();
+}
+
+static bool write_all(int fd, const void *data, std::size_t size) {
+    auto bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *data, std::size_t size) {
+    auto bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t got = read(fd, bytes, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
+
+static void append_string(std::string &payload, std::string_view value) {
+    std::uint32_t size = value.size();
+    payload.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    payload.append(value);
+}
+
+std::optional<int> forward_to_server(const std::string &socket_path, const std::vector<std::string_view> &args) {
+    sockaddr_un address;
+    if (!fill_address(address, socket_path))
+        return std::nullopt;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return std::nullopt;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || !same_user(fd)) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    std::string payload;
+    append_string(payload, std::filesystem::current_path().string());
+    for (auto arg : args)
+        append_string(payload, arg);
+    request_header header{{request_magic[0], request_magic[1], request_magic[2], request_magic[3]},
+        static_cast<std::uint32_t>(payload.size())};
+
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+    iovec io{&header, sizeof(header)};
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *fd_message = CMSG_FIRSTHDR(&message);
+    fd_message->cmsg_level = SOL_SOCKET;
+    fd_message->cmsg_type = SCM_RIGHTS;
+    fd_message->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(fd_message), fds, sizeof(fds));
+
+    std::int32_t status = 1;
+    bool sent = sendmsg(fd, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(header));
+    if (!sent || !write_all(fd, payload.data(), payload.size()) || !read_all(fd, &status, sizeof(status))) {
+        report({diagnostic_level::Error, {}, 0, 0, "Lost the connection to the module server on " + socket_path});
+        status = 1;
+    }
+    close(fd);
+    return status;
+}
+
+// Serves one client; returns false once a client has asked the server to stop
+static bool serve(int client, program_cache &programs) {
+    if (!same_user(client))
+        return true;
+    request_header header;
+    int fds[3] = {-1, -1, -1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+    iovec io{&header, sizeof(header)};
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+
+    // Take every descriptor the client sent before checking the request, so that none leak when it's
+    // rejected
+    std::vector<int> received;
+    if (got >= 0) {
+        for (cmsghdr *fd_message = CMSG_FIRSTHDR(&message); fd_message; fd_message = CMSG_NXTHDR(&message, fd_message)) {
+            if (fd_message->cmsg_level != SOL_SOCKET || fd_message->cmsg_type != SCM_RIGHTS)
+                continue;
+            std::size_t count = (fd_message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (std::size_t i = 0; i < count; i++) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(fd_message) + i * sizeof(int), sizeof(int));
+                received.push_back(fd);
+            }
+        }
+    }
+    if (got != static_cast<ssize_t>(sizeof(header)) || (message.msg_flags & MSG_CTRUNC) || received.size() != 3
+            || std::memcmp(header.magic, request_magic, sizeof(request_magic)) != 0 || header.payload_size > max_payload) {
+        for (int fd : received)
+            close(fd);
+        return true;
+    }
+    std::copy(received.begin(), received.end(), fds);
+
+    std::string payload(header.payload_size, '\0');
+    std::vector<std::string_view> strings;
+    if (read_all(client, payload.data(), payload.size())) {
+        std::string_view rest{payload};
+        while (rest.size() >= sizeof(std::uint32_t)) {
+            std::uint32_t size;
+            std::memcpy(&size, rest.data(), sizeof(size));
+            rest.remove_prefix(sizeof(size));
+            if (size > rest.size())
+                break;
+            strings.push_back(rest.substr(0, size));
+            rest.remove_prefix(size);
+        }
+    }
+
+    bool keep_serving = true;
+    std::int32_t status = 1;
+    if (strings.size() >= 2) {
+        std::string_view cwd = strings.front();
+        std::vector<std::string_view> args(strings.begin() + 1, strings.end());
+        if (std::find(args.begin(), args.end(), "--stop-server"sv) != args.end()) {
+            keep_serving = false;
+            status = 0;
+        } else {
+            // The request runs as if it were the client process: its directory, its terminal
+            auto server_cwd = std::filesystem::current_path();
+            int saved[3] = {dup(STDIN_FILENO), dup(STDOUT_FILENO), dup(STDERR_FILENO)};
+            for (int i = 0; i < 3; i++)
+                dup2(fds[i], i);
+            std::error_code error;
+            std::filesystem::current_path(cwd, error);
+            if (error)
+                report({diagnostic_level::Error, {}, 0, 0, "Cannot enter " + std::string{cwd} + ": " + error.message()});
+            else
+                status = run_driver(args, driver_environment{&programs, true});
+
+            std::cout.flush();
+            std::cerr.flush();
+            llvm::outs().flush();
+            llvm::errs().flush();
+            for (int i = 0; i < 3; i++) {
+                dup2(saved[i], i);
+                close(saved[i]);
+            }
+            std::filesystem::current_path(server_cwd, error);
+        }
+    }
+    for (int fd : fds)
+        close(fd);
+    write_all(client, &status, sizeof(status));
+    return keep_serving;
+}
+
+int run_module_server(const std::string &socket_path, const std::string &default_triple) {
+    sockaddr_un address;
+    if (!fill_address(address, socket_path))
+        return 1;
+    if (forward_to_server(socket_path, {}).has_value()) {
+        report({diagnostic_level::Error, {}, 0, 0, "A module server is already listening on " + socket_path});
+        return 1;
+    }
+    // A socket left behind by a server that didn't shut down cleanly is replaced, but nothing else is
+    struct stat existing;
+    if (lstat(socket_path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode) || existing.st_uid != getuid()) {
+            report({diagnostic_level::Error, {}, 0, 0, socket_path + " exists and is not a socket of this user"});
+            return 1;
+        }
+        unlink(socket_path.c_str());
+    }
+
+    // Only this user may connect; the socket is created without permissions for anyone else
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t old_mask = umask(0177);
+    bool bound = listener >= 0 && bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    umask(old_mask);
+    if (!bound || listen(listener, SOMAXCONN) != 0) {
+        report({diagnostic_level::Error, {}, 0, 0, "Cannot listen on " + socket_path + ": " + std::strerror(errno)});
+        return 1;
+    }
+
+    // Pay for LLVM setup now, rather than in the first request
+    target_machine_lease{target_spec{default_triple}};
+
+    program_cache programs{max_programs};
+    bool keep_serving = true;
+    while (keep_serving) {
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        keep_serving = serve(client, programs);
+        close(client);
+    }
+
+    close(listener);
+    unlink(socket_path.c_str());
+    return 0;
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef CANNON_SERVER_HPP
+#define CANNON_SERVER_HPP
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cannon {
+
+// $XDG_RUNTIME_DIR/cannon-bootstrap.sock, or a per-user socket in /tmp
+std::string default_server_socket();
+
+// Runs the module server (compiler_mode::ModuleServer) on a Unix domain socket until a client asks
+// it to stop. The server keeps LLVM targets initialized, TargetMachines built and analysed programs
+// cached between requests, and runs every request in-process, with the client's working directory
+// and standard streams.
+int run_module_server(const std::string &socket_path, const std::string &default_triple);
+
+// Runs `args` (laid out like argv) on the server at `socket_path`, and returns its exit status, or
+// nothing if no server is listening there
+std::optional<int> forward_to_server(const std::string &socket_path, const std::vector<std::string_view> &args);
+
+}
+
+#endif // CANNON_SERVER_HPP
@@ -0,0 +1,104 @@
+#include "session.hpp"
+
+#include <algorithm>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <Config.hpp>
+
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "driver.hpp"
+#include "error.hpp"
+#include "lex.hpp"
+#include "parser.hpp"
+#include "semantic.hpp"
+#include "source.hpp"
+#include "target.hpp"
+
+namespace cannon {
+
+session::session(session_options options, program_cache *programs) : m_options(std::move(options)), m_programs(programs) {}
+
+const session_options &session::options() const noexcept {
+    return m_options;
+}
+
+static bool has_errors(const std::vector<diagnostic> &diagnostics) {
+    return std::any_of(diagnostics.begin(), diagnostics.end(),
+        [](const diagnostic &d) { return d.level == diagnostic_level::Error; });
+}
+
+// Runs `step` with the compiler's output discarded and its diagnostics collected; false if it failed
+template <typename F>
+static bool run_quietly(std::string_view name, std::vector<diagnostic> &diagnostics, F &&step) {
+    std::ostream discard{nullptr};
+    diagnostic_redirect quiet{discard, discard};
+    source_manager sources;
+    diagnostic_context context{name, &diagnostics, &sources};
+    try {
+        step(sources);
+    } catch (const compiler_exit &) {
+        return false;
+    }
+    return !has_errors(diagnostics);
+}
+
+static std::shared_ptr<const program> analyse(std::string_view name, std::string_view source, source_manager &sources,
+        program_cache *programs) {
+    std::string key;
+    if (programs) {
+        key = cache_key_builder{}.add("source", source).finish();
+        if (auto cached = programs->lookup(key))
+            return cached;
+    }
+    auto &file = sources.add(std::string{name}, std::string{source});
+    auto result = std::make_shared<const program>(analyze(parse_file(lex(file))));
+    if (programs)
+        programs->insert(key, result);
+    return result;
+}
+
+static target_machine_lease target_machine_for(const session_options &options) {
+    return target_machine_lease(target_spec{options.target.empty() ? std::string{CANNON_DEFAULT_TRIPLE} : options.target,
+        options.cpu, options.features});
+}
+
+static codegen_options codegen_options_for(const session_options &options) {
+    return codegen_options{options.opt_level, options.lto, options.emit, options.stats};
+}
+
+compile_result session::compile(std::string_view name, std::string_view source) const {
+    compile_result result;
+    llvm::SmallVector<char, 0> output;
+    bool compiled = run_quietly(name, result.diagnostics, [&](source_manager &sources) {
+        auto analysed = analyse(name, source, sources, m_programs);
+        if (has_errors(result.diagnostics))
+            return;
+        llvm::raw_svector_ostream stream{output};
+        codegen(*analysed, stream, *target_machine_for(m_options), codegen_options_for(m_options));
+    });
+    if (compiled)
+        result.output = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef{output.data(), output.size()}, name);
+    return result;
+}
+
+bool session::check(std::string_view name, std::string_view source, std::vector<diagnostic> &diagnostics) const {
+    return run_quietly(name, diagnostics, [&](source_manager &sources) { analyse(name, source, sources, m_programs); });
+}
+
+compile_result session::compile_ir(std::string_view name, llvm::MemoryBufferRef ir) const {
+    compile_result result;
+    llvm::SmallVector<char, 0> output;
+    bool compiled = run_quietly(name, result.diagnostics, [&](source_manager &) {
+        llvm::raw_svector_ostream stream{output};
+        codegen_ir(ir, stream, *target_machine_for(m_options), codegen_options_for(m_options));
+    });
+    if (compiled)
+        result.output = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef{output.data(), output.size()}, name);
+    return result;
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef CANNON_SESSION_HPP
+#define CANNON_SESSION_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "diagnostics.hpp"
+#include "mode.hpp"
+
+namespace cannon {
+
+class compile_stats;
+class program_cache;
+
+struct session_options {
+    std::string target{};  // empty for the default target
+    std::string cpu{"generic"};
+    std::string features{};
+    optimization_level opt_level{0};
+    emit_kind emit{emit_kind::Object};
+    lto_mode lto{lto_mode::None}; // Thin emits summarized bitcode for a later ThinLTO link
+    compile_stats *stats{nullptr};
+};
+
+// What compiling one source produced. `output` is null if there were errors.
+struct compile_result {
+    std::vector<diagnostic> diagnostics;
+    std::unique_ptr<llvm::MemoryBuffer> output;
+
+    [[nodiscard]] bool success() const noexcept { return output != nullptr; }
+};
+
+// The compiler as a library: compiles sources held in memory, and hands back diagnostics as values
+// and artifacts as buffers, without printing, exiting or touching the file system. A session keeps
+// its target set up and, optionally, analysed programs, so one can serve many compilations; it may
+// be used from several threads at once.
+class session {
+  private:
+    session_options m_options;
+    program_cache *m_programs;
+  public:
+    // `programs`, if given, lets compilations of unchanged sources skip the front-end
+    explicit session(session_options options = {}, program_cache *programs = nullptr);
+
+    // Lexes, parses, analyses and generates code for `source`; `name` is used in diagnostics
+    compile_result compile(std::string_view name, std::string_view source) const;
+    // The front-end alone; returns its diagnostics, and whether there were no errors
+    bool check(std::string_view name, std::string_view source, std::vector<diagnostic> &diagnostics) const;
+    // Generates code for IR (.ll text or .bc bitcode) written by an earlier compile
+    compile_result compile_ir(std::string_view name, llvm::MemoryBufferRef ir) const;
+
+    [[nodiscard]] const session_options &options() const noexcept;
+};
+
+}
+
+#endif // CANNON_SESSION_HPP
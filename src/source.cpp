@@ -0,0 +1,116 @@
+#include "source.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <string>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+namespace cannon {
+
+// Appends the offset of every '\n' in `text`, 16 bytes at a time where SSE2 is available
+static void find_newlines(std::string_view text, std::vector<std::uint64_t> &newlines) {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= text.size(); i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + i));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+        while (mask) {
+            newlines.push_back(i + static_cast<std::uint64_t>(std::countr_zero(mask)));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < text.size(); i++)
+        if (text[i] == '\n')
+            newlines.push_back(i);
+}
+
+std::ostream &operator<<(std::ostream &os, const presumed_location &location) {
+    return os << location.line << ":" << location.column;
+}
+
+source_file::source_file(std::string name, std::string contents, source_location base)
+    : m_name(std::move(name)), m_owned(std::move(contents)), m_contents(m_owned), m_base(base) {}
+
+source_file::source_file(std::string name, std::unique_ptr<llvm::MemoryBuffer> contents, source_location base)
+    : m_name(std::move(name)), m_mapped(std::move(contents)), m_contents(m_mapped->getBuffer()), m_base(base) {}
+
+const std::string &source_file::name() const noexcept {
+    return m_name;
+}
+
+std::string_view source_file::contents() const noexcept {
+    return m_contents;
+}
+
+source_location source_file::base() const noexcept {
+    return m_base;
+}
+
+source_location source_file::location_at(std::uint64_t offset) const noexcept {
+    return m_base + offset;
+}
+
+bool source_file::contains(source_location location) const noexcept {
+    return location >= m_base && location - m_base <= m_contents.size();
+}
+
+presumed_location source_file::presume(source_location location) const {
+    std::call_once(m_lines_built, [this] { find_newlines(m_contents, m_newlines); });
+    std::uint64_t offset = location - m_base;
+    // The newlines before `offset` give its line; a '\n' belongs to the line it ends
+    auto line_index = static_cast<std::size_t>(std::lower_bound(m_newlines.begin(), m_newlines.end(), offset) - m_newlines.begin());
+    std::uint64_t line_start = line_index ? m_newlines[line_index - 1] + 1 : 0;
+    return presumed_location{m_name, line_index + 1, static_cast<std::uint32_t>(offset - line_start + 1)};
+}
+
+source_location source_manager::reserve(const std::string &name, std::size_t size) {
+    // Each file also gets a location for its end
+    if (size >= std::numeric_limits<source_location>::max() - m_next_base) {
+        report({diagnostic_level::Error, name, 0, 0, "Too much source in one compilation"});
+        throw compiler_exit{1};
+    }
+    auto base = m_next_base;
+    m_next_base += size + 1;
+    return base;
+}
+
+const source_file &source_manager::add(std::string name, std::string contents) {
+    std::lock_guard lock{m_mutex};
+    auto base = reserve(name, contents.size());
+    return m_files.emplace_back(std::move(name), std::move(contents), base);
+}
+
+const source_file &source_manager::add(std::string name, std::unique_ptr<llvm::MemoryBuffer> contents) {
+    std::lock_guard lock{m_mutex};
+    auto base = reserve(name, contents->getBufferSize());
+    return m_files.emplace_back(std::move(name), std::move(contents), base);
+}
+
+const source_file *source_manager::find(source_location location) const {
+    if (!location)
+        return nullptr;
+    std::lock_guard lock{m_mutex};
+    // Files are added in order of their bases
+    auto it = std::upper_bound(m_files.begin(), m_files.end(), location,
+        [](source_location l, const source_file &file) { return l < file.base(); });
+    if (it == m_files.begin())
+        return nullptr;
+    --it;
+    return it->contains(location) ? &*it : nullptr;
+}
+
+presumed_location source_manager::presume(source_location location) const {
+    if (auto file = find(location))
+        return file->presume(location);
+    return {};
+}
+
+}
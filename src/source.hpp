@@ -0,0 +1,76 @@
+#ifndef CANNON_SOURCE_HPP
+#define CANNON_SOURCE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace cannon {
+
+// A byte in one of the files of a source_manager: the file's base plus the offset into it. 0 means
+// no location. Line and column are only worked out when something asks for them. 64 bits, so that
+// files of more than 4 GiB, which -fstream-items can compile, still have a location for every byte.
+using source_location = std::uint64_t;
+
+struct presumed_location {
+    std::string_view file;
+    std::uint64_t line{0};
+    std::uint32_t column{0};
+};
+
+// line:column
+std::ostream &operator<<(std::ostream &os, const presumed_location &location);
+
+class source_file {
+  private:
+    std::string m_name;
+    // Text given as a string is kept in one; a file read from disk stays mapped
+    std::string m_owned;
+    std::unique_ptr<llvm::MemoryBuffer> m_mapped;
+    std::string_view m_contents;
+    source_location m_base;
+    mutable std::once_flag m_lines_built;
+    mutable std::vector<std::uint64_t> m_newlines; // offset of every '\n'
+  public:
+    source_file(std::string name, std::string contents, source_location base);
+    source_file(std::string name, std::unique_ptr<llvm::MemoryBuffer> contents, source_location base);
+    source_file(const source_file &) = delete;
+    source_file &operator=(const source_file &) = delete;
+
+    [[nodiscard]] const std::string &name() const noexcept;
+    [[nodiscard]] std::string_view contents() const noexcept;
+    [[nodiscard]] source_location base() const noexcept;
+    [[nodiscard]] source_location location_at(std::uint64_t offset) const noexcept;
+    // One past the end is valid, for the end of the file
+    [[nodiscard]] bool contains(source_location location) const noexcept;
+    // Builds the line table on first use
+    presumed_location presume(source_location location) const;
+};
+
+// Owns the files of one compilation and hands out their locations. Safe to use from several threads.
+class source_manager {
+  private:
+    mutable std::mutex m_mutex;
+    std::deque<source_file> m_files;
+    source_location m_next_base{1};
+
+    // The base the next file of `size` bytes gets
+    source_location reserve(const std::string &name, std::size_t size);
+  public:
+    const source_file &add(std::string name, std::string contents);
+    const source_file &add(std::string name, std::unique_ptr<llvm::MemoryBuffer> contents);
+    // nullptr for 0 and for locations of other managers
+    const source_file *find(source_location location) const;
+    presumed_location presume(source_location location) const;
+};
+
+}
+
+#endif // CANNON_SOURCE_HPP
@@ -0,0 +1,215 @@
+#include "stats.hpp"
+
+#include <sys/resource.h>
+
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_os_ostream.h>
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+static constexpr std::string_view phase_names[compile_phase_count] = {
+    "lex"sv, "parse"sv, "analyze"sv, "codegen"sv, "link"sv,
+};
+
+// Fed by the executables' operator new (allocation_hooks.cpp); a library user's allocations are
+// not counted unless it does the same
+static thread_local std::uint64_t allocation_count = 0;
+static thread_local std::uint64_t allocated_bytes = 0;
+
+void count_allocation(std::size_t size) noexcept {
+    allocation_count++;
+    allocated_bytes += size;
+}
+
+allocation_counts thread_allocations() noexcept {
+    return {allocation_count, allocated_bytes};
+}
+
+static void count_expression(const expression_node &expr, std::map<std::string, std::uint64_t, std::less<>> &counts) {
+    counts[std::string{expr.get_node_name()}]++;
+    if (auto bin_expr = dynamic_cast<const binary_expression_node*>(&expr)) {
+        count_expression(bin_expr->get_lhs(), counts);
+        count_expression(bin_expr->get_rhs(), counts);
+    } else if (auto fn_expr = dynamic_cast<const function_call_expression_node*>(&expr)) {
+        count_expression(fn_expr->get_func(), counts);
+        for (const auto &param : fn_expr->get_params())
+            count_expression(*param, counts);
+    } else if (auto id_expr = dynamic_cast<const identifier_expression_node*>(&expr)) {
+        counts[std::string{id_expr->get_value().get_node_name()}]++;
+    } else if (auto block = dynamic_cast<const block_expression_node*>(&expr)) {
+        for (const auto &statement : block->get_statements())
+            if (auto inner = dynamic_cast<const expression_node*>(&*statement))
+                count_expression(*inner, counts);
+    }
+}
+
+static void count_expression(const expression &expr, std::map<std::string, std::uint64_t, std::less<>> &counts) {
+    if (auto bin_expr = dynamic_cast<const binary_expression*>(&expr)) {
+        counts["Binary expression"]++;
+        count_expression(bin_expr->lhs(), counts);
+        count_expression(bin_expr->rhs(), counts);
+    } else if (auto fn_expr = dynamic_cast<const function_call_expression*>(&expr)) {
+        counts["Function call"]++;
+        count_expression(fn_expr->func(), counts);
+        for (const auto &param : fn_expr->params())
+            count_expression(*param, counts);
+    } else if (dynamic_cast<const identifier_expression*>(&expr)) {
+        counts["Identifier"]++;
+    } else if (dynamic_cast<const integer_expression*>(&expr)) {
+        counts["Integer"]++;
+    } else if (dynamic_cast<const reuse_expression*>(&expr)) {
+        counts["Reuse"]++;
+    }
+}
+
+void compile_stats::add_file() {
+    std::lock_guard lock{m_mutex};
+    m_files++;
+}
+
+void compile_stats::add_tokens(const std::vector<token> &tokens) {
+    std::uint64_t by_type[4] = {};
+    for (const auto &t : tokens)
+        by_type[t.get_type()]++;
+    std::lock_guard lock{m_mutex};
+    m_tokens["symbol"] += by_type[SYMBOL];
+    m_tokens["number"] += by_type[NUMBER];
+    m_tokens["float"] += by_type[FLOAT];
+    m_tokens["identifier"] += by_type[IDENTIFIER];
+}
+
+void compile_stats::add_ast(const file_node &file) {
+    std::map<std::string, std::uint64_t, std::less<>> counts;
+    counts[std::string{file.get_node_name()}]++;
+    for (const auto &item : file.get_items()) {
+        counts[std::string{item->get_node_name()}]++;
+        auto fn = dynamic_cast<const fn_node*>(&*item);
+        if (!fn)
+            continue;
+        counts[std::string{fn->get_name().get_node_name()}]++;
+        for (const auto &parameter : fn->get_parameters())
+            counts[std::string{parameter->get_node_name()}]++;
+        if (auto return_type = fn->get_return_type()) {
+            counts[std::string{return_type->get_node_name()}]++;
+            counts[std::string{return_type->get_name().get_node_name()}]++;
+        }
+        count_expression(fn->get_code(), counts);
+    }
+    std::lock_guard lock{m_mutex};
+    for (auto &[name, count] : counts)
+        m_ast_nodes[name] += count;
+}
+
+void compile_stats::add_hir(const program &p) {
+    std::map<std::string, std::uint64_t, std::less<>> counts;
+    for (const auto &fn : p.functions()) {
+        counts["Function"]++;
+        for (const auto &statement : fn->statements())
+            if (auto expr = dynamic_cast<const expression*>(&*statement))
+                count_expression(*expr, counts);
+    }
+    std::lock_guard lock{m_mutex};
+    for (auto &[name, count] : counts)
+        m_hir_nodes[name] += count;
+}
+
+void compile_stats::add_hir_pass(std::string_view pass, std::uint64_t changes) {
+    std::lock_guard lock{m_mutex};
+    // Listed even when a pass changed nothing, to show that it ran
+    auto it = m_hir_passes.find(pass);
+    if (it == m_hir_passes.end())
+        it = m_hir_passes.emplace(std::string{pass}, 0).first;
+    it->second += changes;
+}
+
+void compile_stats::add_phase(compile_phase phase, const allocation_counts &counts) {
+    std::lock_guard lock{m_mutex};
+    auto &total = m_phases[static_cast<std::size_t>(phase)];
+    total.allocations += counts.allocations;
+    total.bytes += counts.bytes;
+}
+
+void compile_stats::add_llvm_instructions(std::uint64_t count) {
+    std::lock_guard lock{m_mutex};
+    m_llvm_instructions += count;
+}
+
+// In KiB, as Linux reports it
+static std::uint64_t peak_rss() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+}
+
+static std::uint64_t total(const std::map<std::string, std::uint64_t, std::less<>> &counts) {
+    std::uint64_t result = 0;
+    for (auto &[name, count] : counts)
+        result += count;
+    return result;
+}
+
+void compile_stats::print(std::ostream &os) const {
+    std::lock_guard lock{m_mutex};
+    auto section = [&](std::string_view title, const std::map<std::string, std::uint64_t, std::less<>> &counts) {
+        os << title << ": " << total(counts) << std::endl;
+        for (auto &[name, count] : counts)
+            os << "  " << name << ": " << count << std::endl;
+    };
+    os << "Files: " << m_files << std::endl;
+    section("Tokens", m_tokens);
+    section("AST nodes", m_ast_nodes);
+    section("HIR nodes", m_hir_nodes);
+    section("HIR pass changes", m_hir_passes);
+    os << "Allocations:" << std::endl;
+    for (std::size_t i = 0; i < compile_phase_count; i++)
+        os << "  " << phase_names[i] << ": " << m_phases[i].allocations << " allocations, "
+            << m_phases[i].bytes << " bytes" << std::endl;
+    os << "LLVM instructions: " << m_llvm_instructions << std::endl;
+    os << "Peak RSS: " << peak_rss() << " KiB" << std::endl;
+}
+
+void compile_stats::print_json(std::ostream &os) const {
+    std::lock_guard lock{m_mutex};
+    llvm::raw_os_ostream stream{os};
+    llvm::json::OStream json{stream, 2};
+    auto counts_object = [&](llvm::StringRef name, const std::map<std::string, std::uint64_t, std::less<>> &counts) {
+        json.attributeObject(name, [&] {
+            json.attribute("total", total(counts));
+            for (auto &[node, count] : counts)
+                json.attribute(node, count);
+        });
+    };
+    json.object([&] {
+        json.attribute("files", m_files);
+        counts_object("tokens", m_tokens);
+        counts_object("ast-nodes", m_ast_nodes);
+        counts_object("hir-nodes", m_hir_nodes);
+        counts_object("hir-pass-changes", m_hir_passes);
+        json.attributeObject("phases", [&] {
+            for (std::size_t i = 0; i < compile_phase_count; i++) {
+                json.attributeObject(llvm::StringRef{phase_names[i].data(), phase_names[i].size()}, [&] {
+                    json.attribute("allocations", m_phases[i].allocations);
+                    json.attribute("bytes", m_phases[i].bytes);
+                });
+            }
+        });
+        json.attribute("llvm-instructions", m_llvm_instructions);
+        json.attribute("peak-rss-kib", peak_rss());
+    });
+    stream << "\n";
+}
+
+phase_allocations::phase_allocations(compile_stats *stats, compile_phase phase) noexcept
+    : m_stats(stats), m_phase(phase), m_start(thread_allocations()) {}
+
+phase_allocations::~phase_allocations() {
+    if (!m_stats)
+        return;
+    auto end = thread_allocations();
+    m_stats->add_phase(m_phase, {end.allocations - m_start.allocations, end.bytes - m_start.bytes});
+}
+
+}
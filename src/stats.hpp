@@ -0,0 +1,81 @@
+#ifndef CANNON_STATS_HPP
+#define CANNON_STATS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.hpp"
+#include "program.hpp"
+#include "token.hpp"
+
+namespace cannon {
+
+enum class compile_phase {
+    Lex,
+    Parse,
+    Analyze,
+    Codegen,
+    Link,
+};
+
+inline constexpr std::size_t compile_phase_count = 5;
+
+// Allocations made through operator new on the calling thread since it started
+struct allocation_counts {
+    std::uint64_t allocations{0};
+    std::uint64_t bytes{0};
+};
+
+allocation_counts thread_allocations() noexcept;
+// Called by operator new for each allocation
+void count_allocation(std::size_t size) noexcept;
+
+// -fstats: sizes and memory behaviour of one invocation, summed over its input files. Safe to add to
+// from several threads.
+class compile_stats {
+  private:
+    mutable std::mutex m_mutex;
+    std::uint64_t m_files{0};
+    std::map<std::string, std::uint64_t, std::less<>> m_tokens;
+    std::map<std::string, std::uint64_t, std::less<>> m_ast_nodes;
+    std::map<std::string, std::uint64_t, std::less<>> m_hir_nodes;
+    std::map<std::string, std::uint64_t, std::less<>> m_hir_passes; // changes each pass made
+    std::array<allocation_counts, compile_phase_count> m_phases{};
+    std::uint64_t m_llvm_instructions{0};
+  public:
+    void add_file();
+    // Files compiled an item at a time add each item's tokens, AST and HIR on their own
+    void add_tokens(const std::vector<token> &tokens);
+    void add_ast(const file_node &file);
+    void add_hir(const program &p);
+    void add_hir_pass(std::string_view pass, std::uint64_t changes);
+    void add_phase(compile_phase phase, const allocation_counts &counts);
+    void add_llvm_instructions(std::uint64_t count);
+
+    void print(std::ostream &os) const;
+    void print_json(std::ostream &os) const;
+};
+
+// Adds the allocations this thread makes during its lifetime to `phase`, when there are stats
+class phase_allocations {
+  private:
+    compile_stats *m_stats;
+    compile_phase m_phase;
+    allocation_counts m_start;
+  public:
+    phase_allocations(compile_stats *stats, compile_phase phase) noexcept;
+    ~phase_allocations();
+    phase_allocations(const phase_allocations &) = delete;
+    phase_allocations &operator=(const phase_allocations &) = delete;
+};
+
+}
+
+#endif // CANNON_STATS_HPP
@@ -0,0 +1,101 @@
+#include "streaming.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/Support/TimeProfiler.h>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+#include "lex.hpp"
+#include "parser.hpp"
+#include "semantic.hpp"
+#include "stats.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+// Where one top-level item lies in its file, by offset
+struct item_range {
+    std::uint64_t begin;
+    std::uint64_t end;
+};
+
+// What the first pass finds. `functions` numbers the functions in the order they're defined; the
+// names are views into the source, so they outlive the tokens they came from.
+struct file_outline {
+    std::vector<item_range> items;
+    std::unordered_map<std::string_view, std::uint32_t> functions;
+};
+
+// Splits the file at the braces that close top-level items, the way the dependency scan reads
+// them. Anything malformed ends up in an item of its own, for the parser to diagnose.
+static file_outline outline_file(const source_file &file) {
+    llvm::TimeTraceScope trace{"Outline"};
+    file_outline result;
+    literal_table literals;
+    lexer tokens{file, literals};
+    // Where the item being read starts, once it has a token
+    std::uint64_t begin = 0;
+    bool in_item = false;
+    int depth = 0;
+    bool name_next = false;
+    while (auto next = tokens.next_token()) {
+        auto text = next->get_text();
+        if (!in_item) {
+            begin = next->get_location() - file.base();
+            in_item = true;
+        }
+        if (name_next && next->get_type() == IDENTIFIER) {
+            // A whole file compile would quietly emit both; here the second would land on the first
+            if (result.functions.contains(text)) {
+                report({diagnostic_level::Error, {}, 0, 0, "\"" + std::string{text} + "\" is defined more than once", next->get_location()});
+                throw compiler_exit{1};
+            }
+            result.functions.emplace(text, static_cast<std::uint32_t>(result.functions.size()));
+        }
+        name_next = depth == 0 && text == "fn"sv;
+        if (text == "{"sv) {
+            depth++;
+        } else if (text == "}"sv && --depth <= 0) {
+            result.items.push_back({begin, tokens.offset()});
+            in_item = false;
+            depth = 0;
+            // The values are only wanted by the parser, which gets them when the item is lexed again
+            literals = {};
+        }
+    }
+    if (in_item)
+        result.items.push_back({begin, tokens.offset()});
+    return result;
+}
+
+void analyze_streaming(const source_file &file, const symbol_table &imports, const hir_pass_manager &hir_passes,
+        compile_stats *stats, const std::function<void(const function &)> &each) {
+    llvm::TimeTraceScope trace{"Stream items", file.name()};
+    auto outline = outline_file(file);
+    if (stats)
+        stats->add_file();
+    for (const auto &range : outline.items) {
+        auto lexed = lex(file, range.begin, range.end);
+        if (stats)
+            stats->add_tokens(lexed.tokens);
+        auto parsed = parse_file(std::move(lexed));
+        if (stats)
+            stats->add_ast(parsed);
+        for (const auto &item : parsed.get_items()) {
+            const fn_node *func = dynamic_cast<const fn_node*>(&(*item));
+            auto analysed = analyze_item(*func, outline.functions, imports);
+            hir_passes.run(analysed, stats);
+            if (stats)
+                stats->add_hir(analysed);
+            each(*analysed.functions().front());
+        }
+    }
+}
+
+}
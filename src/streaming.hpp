@@ -0,0 +1,31 @@
+#ifndef CANNON_STREAMING_HPP
+#define CANNON_STREAMING_HPP
+
+#include <functional>
+
+#include "hir_passes.hpp"
+#include "module_interface.hpp"
+#include "program.hpp"
+#include "source.hpp"
+
+namespace cannon {
+
+class compile_stats;
+
+// -fstream-items: runs the front-end over `file` one top-level item at a time, for files too large
+// to hold all of their tokens, AST and HIR at once. A first pass lexes the whole file without keeping
+// its tokens, to find where each item starts and ends and which functions the file defines. Each
+// item is then lexed, parsed and analysed on its own, and handed to `each` as a function. Its
+// tokens, AST and HIR are released before the next item is read, so memory holds the mapped source, the
+// file's function names and one item at a time.
+//
+// Each function is analysed alone, so none are pruned as unreachable, and HIR passes that work
+// across functions, like inlining, have nothing to work with. The driver compiles an object from
+// -fstream-chunk=N functions at a time (1024 by default) and joins the pieces, so LLVM's memory is
+// bounded the same way; IR and bitcode output still build one module for the whole file.
+void analyze_streaming(const source_file &file, const symbol_table &imports, const hir_pass_manager &hir_passes,
+    compile_stats *stats, const std::function<void(const function &)> &each);
+
+}
+
+#endif // CANNON_STREAMING_HPP
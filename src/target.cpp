@@ -0,0 +1,176 @@
+#include "target.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
+#include <llvm/Support/TargetRegistry.h>
+#endif
+
+#include <Config.hpp>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+
+using namespace std::string_view_literals;
+
+namespace cannon {
+
+struct llvm_backend {
+    std::string_view arch_prefix; // as returned by llvm::Triple::getArchTypePrefix
+    void (*initialize)();
+};
+
+#define CANNON_LLVM_TARGET(backend, prefix) \
+    llvm_backend{#prefix##sv, [] { \
+        LLVMInitialize##backend##TargetInfo(); \
+        LLVMInitialize##backend##Target(); \
+        LLVMInitialize##backend##TargetMC(); \
+        LLVMInitialize##backend##AsmPrinter(); \
+        LLVMInitialize##backend##AsmParser(); \
+    }},
+
+static const llvm_backend backends[] = {CANNON_LLVM_TARGETS};
+
+#undef CANNON_LLVM_TARGET
+
+static std::mutex targets_mutex;
+static std::set<std::string_view> initialized_backends;
+// The TargetMachines no target_machine_lease holds right now
+static std::map<target_spec, std::vector<std::unique_ptr<llvm::TargetMachine>>> free_target_machines;
+
+bool is_configured_target(std::string_view triple) {
+    std::string normalized = llvm::Triple::normalize(triple);
+    llvm::StringRef configured{CANNON_TARGET_TRIPLES};
+    while (!configured.empty()) {
+        auto [head, tail] = configured.split(',');
+        if (llvm::Triple::normalize(head) == normalized)
+            return true;
+        configured = tail;
+    }
+    return false;
+}
+
+std::string normalized_triple(const target_spec &spec) {
+    return spec.triple.empty() ? llvm::sys::getDefaultTargetTriple() : llvm::Triple::normalize(spec.triple);
+}
+
+bool is_host_target(std::string_view triple) {
+    llvm::Triple target{normalized_triple(target_spec{std::string{triple}})};
+    llvm::Triple host{llvm::sys::getProcessTriple()};
+    return target.getArch() == host.getArch() && target.getOS() == host.getOS();
+}
+
+std::string host_cpu() {
+    return llvm::sys::getHostCPUName().str();
+}
+
+std::string host_features() {
+#if LLVM_VERSION_MAJOR >= 19
+    llvm::StringMap<bool> features = llvm::sys::getHostCPUFeatures();
+#else
+    llvm::StringMap<bool> features;
+    llvm::sys::getHostCPUFeatures(features);
+#endif
+    // Sorted, so the same machine always gets the same cache keys
+    std::set<std::string> sorted;
+    for (const auto &feature : features)
+        sorted.insert((feature.getValue() ? "+" : "-") + feature.getKey().str());
+    std::string result;
+    for (const auto &feature : sorted) {
+        if (!result.empty())
+            result += ',';
+        result += feature;
+    }
+    return result;
+}
+
+// Must be called with targets_mutex held. False if Cannon has no backend for `triple`.
+static bool try_initialize_backend_for(const llvm::Triple &triple) {
+    std::string_view prefix{llvm::Triple::getArchTypePrefix(triple.getArch())};
+    if (initialized_backends.contains(prefix))
+        return true;
+    for (const auto &backend : backends) {
+        if (!prefix.empty() && backend.arch_prefix == prefix) {
+            backend.initialize();
+            initialized_backends.insert(backend.arch_prefix);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Must be called with targets_mutex held. Nothing if Cannon can't build a machine for `spec`, and
+// then `error` says why.
+static std::unique_ptr<llvm::TargetMachine> try_create_target_machine(const target_spec &spec, std::string &error) {
+    std::string targetTriple = normalized_triple(spec);
+    if (!try_initialize_backend_for(llvm::Triple{targetTriple})) {
+        error = "Cannon was not built with support for target " + targetTriple;
+        return nullptr;
+    }
+
+    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
+    if(!target) {
+        error = "Failed to start codegen: " + error;
+        return nullptr;
+    }
+    // Checked before building the machine, which would warn about an unknown CPU itself
+    if (spec.cpu != "generic"sv) {
+        std::unique_ptr<llvm::MCSubtargetInfo> subtarget{target->createMCSubtargetInfo(targetTriple, "", "")};
+        if (!subtarget->isCPUStringValid(spec.cpu)) {
+            error = "Unknown CPU " + spec.cpu + " for target " + targetTriple;
+            return nullptr;
+        }
+    }
+    llvm::TargetOptions options;
+    // Position independent, so the same objects can go into PIE executables and shared libraries
+    llvm::Optional<llvm::Reloc::Model> rm = llvm::Reloc::PIC_;
+    return std::unique_ptr<llvm::TargetMachine>{target->createTargetMachine(targetTriple, spec.cpu, spec.features, options, rm)};
+}
+
+target_machine_lease::target_machine_lease(const target_spec &spec) : m_spec{spec} {
+    std::lock_guard lock{targets_mutex};
+    if (auto &free = free_target_machines[spec]; !free.empty()) {
+        m_machine = std::move(free.back());
+        free.pop_back();
+        return;
+    }
+    std::string error;
+    m_machine = try_create_target_machine(spec, error);
+    if (!m_machine) {
+        report({diagnostic_level::Error, {}, 0, 0, error});
+        throw compiler_exit{1};
+    }
+}
+
+target_machine_lease::~target_machine_lease() {
+    std::lock_guard lock{targets_mutex};
+    free_target_machines[m_spec].push_back(std::move(m_machine));
+}
+
+std::future<void> prepare_target(const target_spec &spec) {
+    return std::async(std::launch::async, [spec] {
+        std::lock_guard lock{targets_mutex};
+        if (!free_target_machines[spec].empty())
+            return;
+        std::string error;
+        if (auto machine = try_create_target_machine(spec, error))
+            free_target_machines[spec].push_back(std::move(machine));
+    });
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef CANNON_TARGET_HPP
+#define CANNON_TARGET_HPP
+
+#include <compare>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <llvm/Target/TargetMachine.h>
+
+namespace cannon {
+
+// Everything that distinguishes one TargetMachine from another
+struct target_spec {
+    std::string triple;
+    std::string cpu{"generic"};
+    std::string features{};
+
+    auto operator<=>(const target_spec &) const = default;
+};
+
+// The triple `spec` is for, normalized; the default target's if it doesn't name one. This is what
+// its TargetMachine reports, without building one.
+std::string normalized_triple(const target_spec &spec);
+
+// Whether `triple` is one of the CANNON_TARGET_TRIPLES this compiler was configured for
+bool is_configured_target(std::string_view triple);
+
+// Whether code for `triple` (empty for the default target) can run on this machine, which
+// -march=native needs
+bool is_host_target(std::string_view triple);
+
+// The CPU this machine has and its features ("+avx2,-avx512f,..."), as -march=native uses them
+std::string host_cpu();
+std::string host_features();
+
+// A TargetMachine for `spec`, checked out of a pool the whole process shares. TargetMachines are
+// not safe to share between threads compiling at the same time, so each lease has one to itself, and
+// gives it back when it ends for the next lease of the same spec, on any thread and in any later
+// compilation of the module server. The first lease for a triple initializes its LLVM backend, and
+// a machine is only built when none is free, so repeated compilations pay the setup cost once. A
+// CPU the backend doesn't know is an error.
+class target_machine_lease {
+  private:
+    target_spec m_spec;
+    std::unique_ptr<llvm::TargetMachine> m_machine;
+  public:
+    explicit target_machine_lease(const target_spec &spec);
+    ~target_machine_lease();
+    target_machine_lease(const target_machine_lease &) = delete;
+    target_machine_lease &operator=(const target_machine_lease &) = delete;
+
+    llvm::TargetMachine &operator*() const { return *m_machine; }
+    llvm::TargetMachine *operator->() const { return m_machine.get(); }
+};
+
+// Starts initializing the LLVM backend for `spec` and building its first TargetMachine on another
+// thread, so that both overlap with the front-end; the machine goes into the pool, and a
+// target_machine_lease waits for it rather than building another. Unknown targets and CPUs are left
+// for target_machine_lease to report. The future is ready once the machine is.
+[[nodiscard]] std::future<void> prepare_target(const target_spec &spec);
+
+}
+
+#endif // CANNON_TARGET_HPP
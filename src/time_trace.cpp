@@ -0,0 +1,46 @@
+#include "time_trace.hpp"
+
+#include <atomic>
+#include <system_error>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "diagnostics.hpp"
+
+namespace cannon {
+
+static constexpr const char *process_name = "cannon-bootstrap";
+
+// Set while a session is running; worker threads pick up its granularity
+static std::atomic<bool> session_running{false};
+static std::atomic<unsigned> session_granularity{0};
+
+time_trace_session::time_trace_session(std::string path, unsigned granularity_us) : m_path(std::move(path)) {
+    session_granularity = granularity_us;
+    session_running = true;
+    llvm::timeTraceProfilerInitialize(granularity_us, process_name);
+}
+
+time_trace_session::~time_trace_session() {
+    session_running = false;
+    // Worker threads have finished by now, and their events are merged into this thread's
+    std::error_code error;
+    llvm::raw_fd_ostream out{m_path, error};
+    if (error)
+        report({diagnostic_level::Error, {}, 0, 0, "Failed to write the time trace to " + m_path + ": " + error.message()});
+    else
+        llvm::timeTraceProfilerWrite(out);
+    llvm::timeTraceProfilerCleanup();
+}
+
+time_trace_thread::time_trace_thread() : m_recording(session_running && !llvm::timeTraceProfilerEnabled()) {
+    if (m_recording)
+        llvm::timeTraceProfilerInitialize(session_granularity, process_name);
+}
+
+time_trace_thread::~time_trace_thread() {
+    if (m_recording)
+        llvm::timeTraceProfilerFinishThread();
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef CANNON_TIME_TRACE_HPP
+#define CANNON_TIME_TRACE_HPP
+
+#include <string>
+
+#include <llvm/Support/TimeProfiler.h>
+
+namespace cannon {
+
+// -ftime-trace: records a Chrome trace (chrome://tracing, Perfetto) of this invocation, covering our
+// own phases (llvm::TimeTraceScope) as well as LLVM's passes. While it is alive, every thread that
+// holds a time_trace_thread records into the trace; when it ends, the trace is written to `path`.
+// Scopes on threads that aren't recording cost a thread-local load and a branch.
+class time_trace_session {
+  private:
+    std::string m_path;
+  public:
+    // Events shorter than `granularity_us` microseconds are dropped
+    time_trace_session(std::string path, unsigned granularity_us);
+    ~time_trace_session();
+    time_trace_session(const time_trace_session &) = delete;
+    time_trace_session &operator=(const time_trace_session &) = delete;
+};
+
+// Records the current worker thread into the running session, if there is one
+class time_trace_thread {
+  private:
+    bool m_recording;
+  public:
+    time_trace_thread();
+    ~time_trace_thread();
+    time_trace_thread(const time_trace_thread &) = delete;
+    time_trace_thread &operator=(const time_trace_thread &) = delete;
+};
+
+}
+
+#endif // CANNON_TIME_TRACE_HPP
@@ -1,15 +1,17 @@
 #include "token.hpp"
 
-#include <string>
+#include <string_view>
 
 namespace cannon {
 
-uint64_t token::get_line() const noexcept { return line; }
+source_location token::get_location() const noexcept { return location; }
 
-uint32_t token::get_column() const noexcept { return column; }
+std::string_view token::get_text() const noexcept { return text; }
 
-std::string token::get_text() const noexcept { return text; }
+name_id token::get_text_id() const noexcept { return value; }
 
 token_type token::get_type() const noexcept { return type; }
 
+std::uint32_t token::get_literal() const noexcept { return value; }
+
 }
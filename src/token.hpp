@@ -2,31 +2,38 @@
 #define CANNON_TOKEN_HPP
 
 #include <cstdint>
+#include <string_view>
 
-#include <string>
+#include "interner.hpp"
+#include "source.hpp"
 
 namespace cannon {
 
 enum token_type {
   SYMBOL,
-  NUMBER,
+  NUMBER, // an integer literal
   IDENTIFIER,
+  FLOAT,
 };
 
 class token {
   private:
-    uint64_t line;
-    uint32_t column;
-    std::string text;
+    source_location location;
+    std::string_view text; // into the source, which outlives the tokens
     token_type type;
+    // NUMBER and FLOAT: index of the value in the file's literal_table. IDENTIFIER: the interned
+    // name, which the AST and HIR keep; no other text is needed past parsing.
+    std::uint32_t value;
 
   public:
-    token(uint64_t line, uint32_t column, std::string text, token_type type) noexcept
-        : line(line), column(column), text(text), type(type) {}
-    [[nodiscard]] uint64_t get_line() const noexcept;
-    [[nodiscard]] uint32_t get_column() const noexcept;
-    [[nodiscard]] std::string get_text() const noexcept;
+    token(source_location location, std::string_view text, token_type type, std::uint32_t literal = 0)
+        : location(location), text(text), type(type), value(type == IDENTIFIER ? interned_names().intern(text) : literal) {}
+    [[nodiscard]] source_location get_location() const noexcept;
+    [[nodiscard]] std::string_view get_text() const noexcept;
+    // Only for IDENTIFIER tokens
+    [[nodiscard]] name_id get_text_id() const noexcept;
     [[nodiscard]] token_type get_type() const noexcept;
+    [[nodiscard]] std::uint32_t get_literal() const noexcept;
 };
 
 } // namespace cannon